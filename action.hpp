@@ -1,6 +1,10 @@
+#pragma once
 #include "message.hpp"
+#include "pin_store.hpp"
+#include "admission.hpp"
 #include <string>
 #include <iostream>
+#include <unordered_map>
 
 struct withdraw
 {
@@ -84,6 +88,10 @@ struct pin_verified
 {};
 struct pin_incorrect
 {};
+struct request_throttled
+{};
+struct display_request_throttled
+{};
 struct display_enter_pin
 {};
 struct display_enter_card
@@ -152,6 +160,13 @@ class atm
                     state=&atm::done_processing;
                 }
                 )
+            .handle<request_throttled>(
+                [&](request_throttled const& msg)
+                {
+                    interface_hardware.send(display_request_throttled());
+                    state=&atm::done_processing;
+                }
+                )
             .handle<cancel_pressed>(
                 [&](cancel_pressed const& msg)
                 {
@@ -173,6 +188,13 @@ class atm
                     state=&atm::wait_for_action;
                 }
                 )
+            .handle<request_throttled>(
+                [&](request_throttled const& msg)
+                {
+                    interface_hardware.send(display_request_throttled());
+                    state=&atm::done_processing;
+                }
+                )
             .handle<cancel_pressed>(
                 [&](cancel_pressed const& msg)
                 {
@@ -223,6 +245,13 @@ class atm
                     state=&atm::done_processing;
                 }
                 )
+            .handle<request_throttled>(
+                [&](request_throttled const& msg)
+                {
+                    interface_hardware.send(display_request_throttled());
+                    state=&atm::done_processing;
+                }
+                )
             .handle<cancel_pressed>(
                 [&](cancel_pressed const& msg)
                 {
@@ -261,8 +290,8 @@ class atm
                 }
                 );
     }
-    //该状态只接收card inserted信息，其他信息会在TemplateDispatcher::wait_and_dispatch()中忽略， 继续进入下一轮 auto msg=q->wait_and_pop(); 等待新消息
-    //如果消息处理成功则TemplateDispatcher, dispatcher先后析构。 
+    //该状态只接收card inserted信息，其他信息会在handler_set::wait_and_dispatch()中忽略， 继续进入下一轮 auto msg=q->wait_and_pop(); 等待新消息
+    //如果消息处理成功则handler_set, dispatcher先后析构。 
     //atm::run()中的主循环执行一次，状态如果在上一轮消息处理中变化，则进入新的状态 开始auto msg=q->wait_and_pop();
     //消息驱动的atm状态变化
     void waiting_for_card() 
@@ -284,6 +313,28 @@ class atm
         interface_hardware.send(eject_card());
         state=&atm::waiting_for_card;
     }
+    //邮箱关闭后的收尾：插着卡就退卡；已经发给bank的请求等回复，超过deadline则取消
+    //返回false表示可以退出run()
+    bool drain_after_close()
+    {
+        if(state==&atm::waiting_for_card)
+        {
+            return false;
+        }
+        if(state==&atm::getting_pin || state==&atm::wait_for_action)
+        {
+            state=&atm::done_processing;
+        }
+        else if(state!=&atm::done_processing && incoming.expired())
+        {
+            if(state==&atm::process_withdrawal)
+            {
+                bank.send(cancel_withdrawal(account,withdrawal_amount));
+            }
+            state=&atm::done_processing;
+        }
+        return true;
+    }
     atm(atm const&)=delete;
     atm& operator=(atm const&)=delete;
 public:
@@ -291,23 +342,23 @@ public:
         messaging::sender interface_hardware_):
         bank(bank_),interface_hardware(interface_hardware_)
     {}
-    void done()
+    //关闭邮箱：deadline之前处理完已经排队的消息后run()返回
+    void done(std::chrono::steady_clock::time_point deadline=
+              std::chrono::steady_clock::time_point::max())
     {
-        get_sender().send(messaging::close_queue());
+        incoming.close(deadline);
     }
     void run()
     {
         state=&atm::waiting_for_card;
-        try
+        for(;;)
         {
-            for(;;)
+            (this->*state)();
+            if(incoming.closed() && !drain_after_close())
             {
-                (this->*state)();
+                break;
             }
         }
-        catch(messaging::close_queue const&)
-        {
-        }
     }
     messaging::sender get_sender()
     {
@@ -319,70 +370,175 @@ public:
 class bank_machine
 {
     messaging::receiver incoming;
-    unsigned balance;
+    std::unordered_map<std::string,unsigned> balances;
+    //已扣款、还没等到withdrawal_processed或cancel_withdrawal的取款
+    std::unordered_multimap<std::string,unsigned> outstanding;
+    pin_store pins;
+    admission_control admission;//按账户/ATM限流，放在账户表旁边
+    std::vector<verify_pin> pending_pins;//攒批校验的verify_pin请求
+    static std::size_t const max_pin_batch=64;
+    //一批最多等待这么多条其他消息或这么长时间，防止持续的其他流量把PIN校验一直压着
+    static unsigned const max_pin_wait_messages=64;
+    static constexpr std::chrono::microseconds max_pin_wait{200};
+    unsigned pin_wait_messages;
+    std::chrono::steady_clock::time_point oldest_pin;
+
+    //结清一笔在途取款，没有对应的扣款(比如被拒绝或限流)返回false
+    bool settle(std::string const& account,unsigned amount)
+    {
+        auto range=outstanding.equal_range(account);
+        for(auto it=range.first;it!=range.second;++it)
+        {
+            if(it->second==amount)
+            {
+                outstanding.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool pin_batch_due()
+    {
+        if(pending_pins.empty())
+        {
+            return false;
+        }
+        return pending_pins.size()>=max_pin_batch || incoming.empty() ||
+            ++pin_wait_messages>=max_pin_wait_messages ||
+            std::chrono::steady_clock::now()-oldest_pin>=max_pin_wait;
+    }
+
+    void verify_pending_pins()
+    {
+        std::size_t const n=pending_pins.size();
+        std::vector<std::string const*> accounts(n),entered(n);
+        std::unique_ptr<bool[]> ok(new bool[n]);
+        for(std::size_t i=0;i<n;++i)
+        {
+            accounts[i]=&pending_pins[i].account;
+            entered[i]=&pending_pins[i].pin;
+        }
+        pins.verify(accounts.data(),entered.data(),n,ok.get());
+        for(std::size_t i=0;i<n;++i)
+        {
+            admission.record_pin_result(pending_pins[i].account,ok[i]);
+            if(ok[i])
+            {
+                pending_pins[i].atm_queue.send(pin_verified());
+            }
+            else
+            {
+                pending_pins[i].atm_queue.send(pin_incorrect());
+            }
+        }
+        pending_pins.clear();
+        pin_wait_messages=0;
+    }
 public:
-    bank_machine():
-        balance(199)
-    {}
-    void done()
+    static admission_limits default_limits()
     {
-        get_sender().send(messaging::close_queue());
+        return admission_limits{5,10,3,std::chrono::minutes(5)};//每秒5次，突发10次，错3次锁5分钟
+    }
+    explicit bank_machine(admission_limits const& limits=default_limits()):
+        incoming(messaging::wait_policy::spinning()),//bank在每次往返的关键路径上，自旋等待
+        admission(limits),
+        pin_wait_messages(0)
+    {
+        open_account("acc1234","1937",199);
+    }
+    //开户，只能在run()之前调用
+    void open_account(std::string const& account,std::string const& pin,
+                      unsigned balance)
+    {
+        pins.enroll(account,pin);
+        balances[account]=balance;
+    }
+    //关闭邮箱：deadline之前处理完已经排队的消息后run()返回
+    void done(std::chrono::steady_clock::time_point deadline=
+              std::chrono::steady_clock::time_point::max())
+    {
+        incoming.close(deadline);
     }
     void run()
     {
-        try
+        while(!incoming.closed())
         {
-            for(;;)
-            {
-                incoming.wait()
-                    .handle<verify_pin>(
-                        [&](verify_pin const& msg)
+            incoming.wait()
+                .handle<verify_pin>(
+                    [&](verify_pin const& msg)
+                    {
+                        if(!admission.admit(msg.account,msg.atm_queue.id(),true))
                         {
-                            if(msg.pin=="1937")
-                            {
-                                msg.atm_queue.send(pin_verified());
-                            }
-                            else
-                            {
-                                msg.atm_queue.send(pin_incorrect());
-                            }
+                            msg.atm_queue.send(request_throttled());
+                            return;
                         }
-                        )
-                    .handle<withdraw>(
-                        [&](withdraw const& msg)
+                        if(pending_pins.empty())
                         {
-                            if(balance>=msg.amount)
-                            {
-                                msg.atm_queue.send(withdraw_ok());
-                                balance-=msg.amount;
-                            }
-                            else
-                            {
-                                msg.atm_queue.send(withdraw_denied());
-                            }
+                            oldest_pin=std::chrono::steady_clock::now();
                         }
-                        )
-                    .handle<get_balance>(
-                        [&](get_balance const& msg)
+                        pending_pins.push_back(msg);
+                    }
+                    )
+                .handle<withdraw>(
+                    [&](withdraw const& msg)
+                    {
+                        if(!admission.admit(msg.account,msg.atm_queue.id()))
+                        {
+                            msg.atm_queue.send(request_throttled());
+                            return;
+                        }
+                        auto it=balances.find(msg.account);
+                        if(it!=balances.end() && it->second>=msg.amount)
                         {
-                            msg.atm_queue.send(::balance(balance));
+                            msg.atm_queue.send(withdraw_ok());
+                            it->second-=msg.amount;
+                            outstanding.emplace(msg.account,msg.amount);
                         }
-                        )
-                    .handle<withdrawal_processed>(
-                        [&](withdrawal_processed const& msg)
+                        else
                         {
+                            msg.atm_queue.send(withdraw_denied());
                         }
-                        )
-                    .handle<cancel_withdrawal>(
-                        [&](cancel_withdrawal const& msg)
+                    }
+                    )
+                .handle<get_balance>(
+                    [&](get_balance const& msg)
+                    {
+                        if(!admission.admit(msg.account,msg.atm_queue.id()))
                         {
+                            msg.atm_queue.send(request_throttled());
+                            return;
                         }
-                        );
-                std::cout << "BANK LOOP ONE TIEM" << std::endl;
+                        auto it=balances.find(msg.account);
+                        msg.atm_queue.send(
+                            ::balance(it!=balances.end()?it->second:0));
+                    }
+                    )
+                .handle<withdrawal_processed>(
+                    [&](withdrawal_processed const& msg)
+                    {
+                        settle(msg.account,msg.amount);
+                    }
+                    )
+                .handle<cancel_withdrawal>(
+                    [&](cancel_withdrawal const& msg)
+                    {
+                        //同一个atm的withdraw一定先于它的cancel_withdrawal到达，有扣款就退回
+                        if(settle(msg.account,msg.amount))
+                        {
+                            balances[msg.account]+=msg.amount;
+                        }
+                    }
+                    );
+            //队列空了、攒满一批或者最早的请求等得太久时，统一哈希校验
+            if(pin_batch_due())
+            {
+                verify_pending_pins();
             }
         }
-        catch(messaging::close_queue const&)
+        if(!pending_pins.empty())
         {
+            verify_pending_pins();
         }
     }
     messaging::sender get_sender()
@@ -397,114 +553,119 @@ class interface_machine
     messaging::receiver incoming;
     std::mutex iom;
 public:
-    void done()
+    //关闭邮箱：deadline之前处理完已经排队的消息后run()返回
+    void done(std::chrono::steady_clock::time_point deadline=
+              std::chrono::steady_clock::time_point::max())
     {
-        get_sender().send(messaging::close_queue());
+        incoming.close(deadline);
     }
     void run()
     {
-        try
+        while(!incoming.closed())
         {
-            for(;;)
-            {
-                incoming.wait()
-                    .handle<issue_money>(
-                        [&](issue_money const& msg)
+            incoming.wait()
+                .handle<issue_money>(
+                    [&](issue_money const& msg)
+                    {
+                        {
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout<<"Issuing "
+                                     <<msg.amount<<std::endl;
+                        }
+                    }
+                    )
+                .handle<display_insufficient_funds>(
+                    [&](display_insufficient_funds const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout<<"Issuing "
-                                         <<msg.amount<<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout<<"Insufficient funds"<<std::endl;
                         }
-                        )
-                    .handle<display_insufficient_funds>(
-                        [&](display_insufficient_funds const& msg)
+                    }
+                    )
+                .handle<display_enter_pin>(
+                    [&](display_enter_pin const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout<<"Insufficient funds"<<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout
+                                <<"Please enter your PIN (0-9)"
+                                <<std::endl;
                         }
-                        )
-                    .handle<display_enter_pin>(
-                        [&](display_enter_pin const& msg)
+                    }
+                    )
+                .handle<display_enter_card>(
+                    [&](display_enter_card const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout
-                                    <<"Please enter your PIN (0-9)"
-                                    <<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout<<"Please enter your card (I)"
+                                     <<std::endl;
                         }
-                        )
-                    .handle<display_enter_card>(
-                        [&](display_enter_card const& msg)
+                    }
+                    )
+                .handle<display_balance>(
+                    [&](display_balance const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout<<"Please enter your card (I)"
-                                         <<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout
+                                <<"The balance of your account is "
+                                <<msg.amount<<std::endl;
                         }
-                        )
-                    .handle<display_balance>(
-                        [&](display_balance const& msg)
+                    }
+                    )
+                .handle<display_withdrawal_options>(
+                    [&](display_withdrawal_options const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout
-                                    <<"The balance of your account is "
-                                    <<msg.amount<<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout<<"Withdraw 50? (w)"<<std::endl;
+                            std::cout<<"Display Balance? (b)"
+                                     <<std::endl;
+                            std::cout<<"Cancel? (c)"<<std::endl;
                         }
-                        )
-                    .handle<display_withdrawal_options>(
-                        [&](display_withdrawal_options const& msg)
+                    }
+                    )
+                .handle<display_withdrawal_cancelled>(
+                    [&](display_withdrawal_cancelled const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout<<"Withdraw 50? (w)"<<std::endl;
-                                std::cout<<"Display Balance? (b)"
-                                         <<std::endl;
-                                std::cout<<"Cancel? (c)"<<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout<<"Withdrawal cancelled"
+                                     <<std::endl;
                         }
-                        )
-                    .handle<display_withdrawal_cancelled>(
-                        [&](display_withdrawal_cancelled const& msg)
+                    }
+                    )
+                .handle<display_pin_incorrect_message>(
+                    [&](display_pin_incorrect_message const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout<<"Withdrawal cancelled"
-                                         <<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout<<"PIN incorrect"<<std::endl;
                         }
-                        )
-                    .handle<display_pin_incorrect_message>(
-                        [&](display_pin_incorrect_message const& msg)
+                    }
+                    )
+                .handle<display_request_throttled>(
+                    [&](display_request_throttled const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout<<"PIN incorrect"<<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout<<"Too many requests, please try later"
+                                     <<std::endl;
                         }
-                        )
-                    .handle<eject_card>(
-                        [&](eject_card const& msg)
+                    }
+                    )
+                .handle<eject_card>(
+                    [&](eject_card const& msg)
+                    {
                         {
-                            {
-                                std::lock_guard<std::mutex> lk(iom);
-                                std::cout<<"Ejecting card"<<std::endl;
-                            }
+                            std::lock_guard<std::mutex> lk(iom);
+                            std::cout<<"Ejecting card"<<std::endl;
                         }
-                        );
-                std::cout << "INTERFACE LOOP ONE TIEM" << std::endl;
-            }
-        }
-        catch(messaging::close_queue&)
-        {
-            std::cout << "INTERFACE catch close_queue" << std::endl;
+                    }
+                    );
+            std::cout << "INTERFACE LOOP ONE TIEM" << std::endl;
         }
     }
     messaging::sender get_sender()
@@ -512,41 +673,3 @@ public:
         return incoming;
     }
 };
-
-
-
-// assign TemplateDispatcher: 1
-// assign TemplateDispatcher: 2
-// assign TemplateDispatcher: 3
-// assign TemplateDispatcher: 4
-// assign TemplateDispatcher: 5
-// assign TemplateDispatcher: 6
-// assign TemplateDispatcher: 7
-// assign TemplateDispatcher: 8
-// assign TemplateDispatcher: 9
-// assign TemplateDispatcher: 10
-// assign TemplateDispatcher: 11
-// assign TemplateDispatcher: 12
-// assign TemplateDispatcher: 13
-// assign TemplateDispatcher: 14
-// assign TemplateDispatcher: 15
-// Please enter your card (I)
-// ~TemplateDispatcher: 15
-// ~TemplateDispatcher: 14
-// ~TemplateDispatcher: 13
-// ~TemplateDispatcher: 12
-// ~TemplateDispatcher: 11
-// ~TemplateDispatcher: 10
-// ~TemplateDispatcher: 9
-// ~TemplateDispatcher: 8
-// ~TemplateDispatcher: 6
-// INTERFACE LOOP ONE TIEM
-// assign TemplateDispatcher: 16
-// assign TemplateDispatcher: 17
-// assign TemplateDispatcher: 18
-// assign TemplateDispatcher: 19
-// assign TemplateDispatcher: 20
-// assign TemplateDispatcher: 21
-// assign TemplateDispatcher: 22
-// assign TemplateDispatcher: 23
-// assign TemplateDispatcher: 24
\ No newline at end of file
@@ -0,0 +1,307 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+//令牌桶的参数
+struct admission_limits
+{
+    double rate;              //每秒补充的令牌数
+    double burst;             //桶容量
+    unsigned max_pin_failures;//连续输错PIN的次数上限
+    std::chrono::microseconds lockout;//达到上限后锁定的时长
+};
+
+//定长、开放寻址的无锁令牌桶表
+//每个槽的桶状态打包在一个64位原子量里：高44位为上次补充的时间(毫秒，从1开始，约557年不会溢出)，
+//低20位为毫令牌数，0表示满桶
+//探测窗口内没有空槽时，回收一个空闲槽：桶已补满、未锁定、没有在途的PIN校验、
+//最近failure_window内没有PIN错误。有错误记录或处于锁定中的槽不会被回收，所以表满不会让锁定失效
+class rate_table
+{
+    static unsigned const token_bits=20;
+    static std::uint64_t const token_mask=(std::uint64_t(1)<<token_bits)-1;
+    static unsigned const max_probe=16;
+
+    struct slot
+    {
+        std::atomic<std::uint64_t> key;
+        std::atomic<std::uint64_t> bucket;
+        std::atomic<std::uint32_t> failures;
+        std::atomic<std::uint32_t> pending;//已放行、还没有结果的PIN校验
+        std::atomic<std::uint64_t> last_failure;
+        std::atomic<std::uint64_t> locked_until;
+    };
+    std::size_t const mask;
+    std::unique_ptr<slot[]> slots;
+    std::uint64_t const rate_milli;//每秒补充的毫令牌
+    std::uint64_t const burst_milli;
+    std::uint64_t const failure_window;//PIN错误计数的有效期(微秒)
+
+    //桶里的时间戳：微秒换算成毫秒并从1开始，空桶的编码不会和"满桶"的0混淆
+    static std::uint64_t bucket_time(std::uint64_t now_us)
+    {
+        return now_us/1000+1;
+    }
+    //把桶补充到now(毫秒)，返回(时间戳, 毫令牌数)
+    void refill(std::uint64_t bucket,std::uint64_t now,
+                std::uint64_t& stamp,std::uint64_t& tokens) const
+    {
+        stamp=bucket>>token_bits;
+        tokens=bucket&token_mask;
+        if(bucket==0)
+        {
+            tokens=burst_milli;
+        }
+        else if(now>stamp && rate_milli)
+        {
+            //只把时间戳推进到已折算成令牌的部分，避免高频调用时零头被吞掉
+            std::uint64_t const elapsed=now-stamp;
+            std::uint64_t const added=elapsed<burst_milli*1000/rate_milli+1?
+                elapsed*rate_milli/1000:burst_milli;
+            tokens+=added;
+            stamp+=added*1000/rate_milli;
+        }
+        if(tokens>=burst_milli)
+        {
+            tokens=burst_milli;
+            stamp=now;
+        }
+    }
+    bool failures_expired(slot const& s,std::uint64_t now) const
+    {
+        return now-s.last_failure.load(std::memory_order_relaxed)>=failure_window;
+    }
+    bool idle(slot const& s,std::uint64_t now) const
+    {
+        if(s.locked_until.load(std::memory_order_relaxed)>now)
+        {
+            return false;
+        }
+        if(s.pending.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        if(s.failures.load(std::memory_order_relaxed) && !failures_expired(s,now))
+        {
+            return false;
+        }
+        std::uint64_t stamp,tokens;
+        refill(s.bucket.load(std::memory_order_relaxed),bucket_time(now),stamp,tokens);
+        return tokens>=burst_milli;
+    }
+
+    //insert为false时只查找；为true时找不到就占用空槽或回收空闲槽，都没有返回nullptr
+    slot* find(std::uint64_t key,std::uint64_t now,bool insert)
+    {
+        if(key==0)//0表示空槽；哈希为0的键挪到~0，只和这一个值冲突
+        {
+            key=~std::uint64_t(0);
+        }
+        slot* victim=nullptr;
+        for(unsigned i=0;i<max_probe;++i)
+        {
+            slot& s=slots[(key+i)&mask];
+            std::uint64_t k=s.key.load(std::memory_order_acquire);
+            if(k==key)
+            {
+                return &s;
+            }
+            if(k==0)
+            {
+                if(!insert)
+                {
+                    return nullptr;
+                }
+                if(s.key.compare_exchange_strong(k,key,std::memory_order_acq_rel) || k==key)
+                {
+                    return &s;
+                }
+            }
+            if(insert && !victim && idle(s,now))
+            {
+                victim=&s;
+            }
+        }
+        if(!victim)
+        {
+            return nullptr;
+        }
+        std::uint64_t k=victim->key.load(std::memory_order_acquire);
+        if(!idle(*victim,now) ||
+           !victim->key.compare_exchange_strong(k,key,std::memory_order_acq_rel))
+        {
+            return nullptr;
+        }
+        //空闲槽的状态和新槽等价，只需清掉过期的错误计数
+        victim->bucket.store(0,std::memory_order_relaxed);
+        victim->failures.store(0,std::memory_order_relaxed);
+        return victim;
+    }
+public:
+    rate_table(std::size_t capacity_pow2,double rate,double burst,
+               std::uint64_t failure_window_):
+        mask(capacity_pow2-1),slots(new slot[capacity_pow2]()),
+        rate_milli(static_cast<std::uint64_t>(rate*1000)),
+        burst_milli(static_cast<std::uint64_t>(burst*1000)<token_mask?
+                    static_cast<std::uint64_t>(burst*1000):token_mask),
+        failure_window(failure_window_)
+    {}
+    //取一个令牌，成功返回true；表中没有位置时返回fail_open
+    bool acquire(std::uint64_t key,std::uint64_t now,bool fail_open)
+    {
+        slot* s=find(key,now,true);
+        if(!s)
+        {
+            return fail_open;
+        }
+        std::uint64_t const t=bucket_time(now);
+        std::uint64_t old=s->bucket.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            std::uint64_t stamp,tokens;
+            refill(old,t,stamp,tokens);
+            if(tokens<1000)
+            {
+                return false;
+            }
+            std::uint64_t const desired=(stamp<<token_bits)|(tokens-1000);
+            if(s->bucket.compare_exchange_weak(old,desired,std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+    }
+    bool locked(std::uint64_t key,std::uint64_t now)
+    {
+        slot* s=find(key,now,false);
+        return s && s->locked_until.load(std::memory_order_relaxed)>now;
+    }
+    //放行一次PIN校验之前调用：把它先算作一次在途的失败，
+    //已有的失败加上在途的校验达到max_failures时拒绝，表中占不到位置也拒绝
+    bool reserve_pin(std::uint64_t key,std::uint64_t now,unsigned max_failures)
+    {
+        slot* s=find(key,now,true);
+        if(!s)
+        {
+            return false;
+        }
+        if(failures_expired(*s,now))
+        {
+            s->failures.store(0,std::memory_order_relaxed);
+        }
+        std::uint32_t pending=s->pending.load(std::memory_order_relaxed);
+        do
+        {
+            if(std::uint64_t(s->failures.load(std::memory_order_relaxed))+pending>=max_failures)
+            {
+                return false;
+            }
+        }
+        while(!s->pending.compare_exchange_weak(pending,pending+1,std::memory_order_relaxed));
+        return true;
+    }
+    //撤销reserve_pin(请求最终没有被放行)
+    void release_pin(std::uint64_t key,std::uint64_t now)
+    {
+        if(slot* s=find(key,now,false))
+        {
+            s->pending.fetch_sub(1,std::memory_order_relaxed);
+        }
+    }
+    //记录一次reserve_pin过的PIN校验的结果，failure_window内连续失败达到上限后锁定到now+lockout
+    //失败结果在表中没有位置记录时返回false
+    bool record(std::uint64_t key,bool success,std::uint64_t now,
+                unsigned max_failures,std::uint64_t lockout)
+    {
+        slot* s=find(key,now,false);
+        if(!s)
+        {
+            return success;
+        }
+        s->pending.fetch_sub(1,std::memory_order_relaxed);
+        if(success)
+        {
+            s->failures.store(0,std::memory_order_relaxed);
+            return true;
+        }
+        if(failures_expired(*s,now))
+        {
+            s->failures.store(0,std::memory_order_relaxed);
+        }
+        s->last_failure.store(now,std::memory_order_relaxed);
+        if(s->failures.fetch_add(1,std::memory_order_relaxed)+1>=max_failures)
+        {
+            s->failures.store(0,std::memory_order_relaxed);
+            s->locked_until.store(now+lockout,std::memory_order_relaxed);
+        }
+        return true;
+    }
+};
+
+//bank的准入控制：按账户和按ATM各一张令牌桶表，再加上PIN错误锁定
+class admission_control
+{
+    admission_limits limits;
+    rate_table accounts;
+    rate_table atms;
+    std::chrono::steady_clock::time_point const epoch;
+
+    std::uint64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now()-epoch).count()+1;
+    }
+    static std::uint64_t account_key(std::string const& account)
+    {
+        return std::hash<std::string>()(account);
+    }
+    static std::uint64_t atm_key(void const* atm)
+    {
+        std::uint64_t x=reinterpret_cast<std::uintptr_t>(atm);
+        x^=x>>33;x*=0xff51afd7ed558ccdULL;x^=x>>33;//打散指针的低位
+        return x;
+    }
+public:
+    admission_control(admission_limits const& limits_,std::size_t capacity_pow2=1<<14):
+        limits(limits_),
+        accounts(capacity_pow2,limits_.rate,limits_.burst,limits_.lockout.count()),
+        atms(capacity_pow2,limits_.rate,limits_.burst,limits_.lockout.count()),
+        epoch(std::chrono::steady_clock::now())
+    {}
+    //在做任何实际工作之前调用，返回false表示应当拒绝
+    //pin_attempt为true时账户必须在表里占到位置(否则无法记录错误次数)，占不到就拒绝；
+    //放行的PIN校验在出结果之前就计入错误次数，攒批期间同一账户最多放行max_pin_failures次，
+    //之后必须调用record_pin_result。其他请求在表满时只放宽令牌桶
+    bool admit(std::string const& account,void const* atm,bool pin_attempt=false)
+    {
+        std::uint64_t const t=now();
+        std::uint64_t const key=account_key(account);
+        if(accounts.locked(key,t))
+        {
+            return false;
+        }
+        if(pin_attempt && !accounts.reserve_pin(key,t,limits.max_pin_failures))
+        {
+            return false;
+        }
+        if(atms.acquire(atm_key(atm),t,true) && accounts.acquire(key,t,!pin_attempt))
+        {
+            return true;
+        }
+        if(pin_attempt)
+        {
+            accounts.release_pin(key,t);
+        }
+        return false;
+    }
+    //admit(...,true)放行的每个PIN校验出结果后调用一次
+    void record_pin_result(std::string const& account,bool success)
+    {
+        accounts.record(account_key(account),success,now(),
+                        limits.max_pin_failures,limits.lockout.count());
+    }
+};
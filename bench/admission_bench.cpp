@@ -0,0 +1,131 @@
+//准入控制：admit()热路径的单次开销，以及一个客户端狂刷时另一个客户端能否得到服务
+#include "action.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock clock_type;
+
+//64个账户、64台ATM轮流admit，限流参数放宽到几乎不会拒绝，只测哈希、查表和CAS的开销
+//(同一个桶每毫秒最多补充约1000个令牌，只用一个账户会很快被限流，测到的是拒绝路径)
+static void hot_path()
+{
+    int const calls=5000000;
+    admission_control admission(admission_limits{1e9,1e6,3,std::chrono::minutes(5)});
+    std::vector<std::string> accounts;
+    for(int i=0;i<64;++i)
+    {
+        accounts.push_back("acc"+std::to_string(1000+i));
+    }
+    char atms[64];
+    unsigned admitted=0;
+    auto const t0=clock_type::now();
+    for(int i=0;i<calls;++i)
+    {
+        admitted+=admission.admit(accounts[i&63],&atms[i&63]);
+    }
+    double const ns=std::chrono::duration<double,std::nano>(clock_type::now()-t0).count()/calls;
+    std::printf("admit() hot path: %.1f ns/call (%u of %d admitted)\n",ns,admitted,calls);
+}
+
+//一台ATM尽可能快地对自己的账户发withdraw，另一台每250ms查一次余额
+static void hostile_client()
+{
+    bank_machine bank;
+    bank.open_account("hostile","0000",1000000000);
+    std::thread bank_thread(&bank_machine::run,&bank);
+    messaging::sender to_bank=bank.get_sender();
+
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long> sent(0),replied(0),served(0);
+    messaging::receiver hostile_replies;
+    std::thread hostile([&]
+    {
+        while(!stop.load(std::memory_order_relaxed))
+        {
+            //最多1000个在途请求，避免邮箱无限增长
+            if(sent.load(std::memory_order_relaxed)-replied.load(std::memory_order_relaxed)<1000)
+            {
+                to_bank.send(withdraw("hostile",1,hostile_replies));
+                sent.fetch_add(1,std::memory_order_relaxed);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+        to_bank.send(withdraw("hostile",1,hostile_replies));//保证收尾时至少还有一个回复
+        sent.fetch_add(1,std::memory_order_relaxed);
+    });
+    std::thread drain([&]
+    {
+        while(!stop.load(std::memory_order_relaxed) ||
+              replied.load(std::memory_order_relaxed)<sent.load(std::memory_order_relaxed))
+        {
+            hostile_replies.wait()
+                .handle<withdraw_ok>(
+                    [&](withdraw_ok const& msg)
+                    {
+                        served.fetch_add(1,std::memory_order_relaxed);
+                    }
+                    )
+                .handle<withdraw_denied>(
+                    [&](withdraw_denied const& msg)
+                    {
+                        served.fetch_add(1,std::memory_order_relaxed);
+                    }
+                    )
+                .handle<request_throttled>(
+                    [&](request_throttled const& msg)
+                    {
+                    }
+                    );
+            replied.fetch_add(1,std::memory_order_relaxed);
+        }
+    });
+
+    int const rounds=20;
+    unsigned honest_served=0;
+    std::vector<double> latencies;
+    messaging::receiver honest;
+    for(int i=0;i<rounds;++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        auto const t0=clock_type::now();
+        to_bank.send(get_balance("acc1234",honest));
+        honest.wait()
+            .handle<balance>(
+                [&](balance const& msg)
+                {
+                    ++honest_served;
+                }
+                )
+            .handle<request_throttled>(
+                [&](request_throttled const& msg)
+                {
+                }
+                );
+        latencies.push_back(std::chrono::duration<double,std::micro>(clock_type::now()-t0).count());
+    }
+    stop=true;
+    hostile.join();
+    drain.join();
+    bank.done();
+    bank_thread.join();
+
+    std::sort(latencies.begin(),latencies.end());
+    std::printf("honest client: %u/%d served, p50 %.0f us, max %.0f us\n",
+                honest_served,rounds,latencies[latencies.size()/2],latencies.back());
+    std::printf("hostile client: %lu of %lu requests reached the balance check\n",
+                served.load(),sent.load());
+}
+
+int main()
+{
+    hot_path();
+    hostile_client();
+}
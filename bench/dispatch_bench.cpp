@@ -0,0 +1,56 @@
+//handler链的派发开销：单线程预先填满邮箱，再逐条wait().handle<...>()取出
+//消息类型分别匹配链中第1个和第6个处理函数，各跑5轮取最快的一轮
+#include "message.hpp"
+#include <chrono>
+#include <cstdio>
+
+template<int N>
+struct msg
+{};
+
+static unsigned long hits=0;
+
+static void receive(messaging::receiver& incoming)
+{
+    incoming.wait()
+        .handle<msg<0> >([&](msg<0> const&){ ++hits; })
+        .handle<msg<1> >([&](msg<1> const&){ ++hits; })
+        .handle<msg<2> >([&](msg<2> const&){ ++hits; })
+        .handle<msg<3> >([&](msg<3> const&){ ++hits; })
+        .handle<msg<4> >([&](msg<4> const&){ ++hits; })
+        .handle<msg<5> >([&](msg<5> const&){ ++hits; });
+}
+
+static int const count=200000;
+static int const rounds=5;
+
+template<int N>
+static void run()
+{
+    messaging::receiver incoming;
+    messaging::sender to_self=incoming;
+    double best=0;
+    for(int r=0;r<rounds;++r)
+    {
+        for(int i=0;i<count;++i)
+        {
+            to_self.send(msg<N>());
+        }
+        auto const start=std::chrono::steady_clock::now();
+        for(int i=0;i<count;++i)
+        {
+            receive(incoming);
+        }
+        double const ns=std::chrono::duration<double,std::nano>(
+            std::chrono::steady_clock::now()-start).count()/count;
+        best=(r==0 || ns<best)?ns:best;
+    }
+    std::printf("handler %d of 6: %.1f ns/msg\n",N+1,best);
+}
+
+int main()
+{
+    run<0>();
+    run<5>();
+    return hits==2ul*rounds*count?0:1;
+}
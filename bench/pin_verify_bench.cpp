@@ -0,0 +1,44 @@
+//pin_store::verify 在不同批大小下每秒能校验的PIN数
+#include "pin_store.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+int main()
+{
+    pin_store store;
+    std::vector<std::string> accounts,pins;
+    for(int i=0;i<1024;++i)
+    {
+        accounts.push_back("acc"+std::to_string(i));
+        pins.push_back(std::to_string(1000+i));
+        store.enroll(accounts[i],pins[i]);
+    }
+    std::size_t const total=400000;
+    for(std::size_t batch:{1,8,64})
+    {
+        std::vector<std::string const*> a(batch),p(batch);
+        std::vector<char> results(batch);
+        std::size_t done=0,ok=0;
+        auto const start=std::chrono::steady_clock::now();
+        for(std::size_t it=0;done<total;++it)
+        {
+            for(std::size_t i=0;i<batch;++i)
+            {
+                a[i]=&accounts[(it*batch+i)%1024];
+                p[i]=&pins[(it*batch+i)%1024];
+            }
+            store.verify(a.data(),p.data(),batch,reinterpret_cast<bool*>(results.data()));
+            for(std::size_t i=0;i<batch;++i)
+            {
+                ok+=results[i];
+            }
+            done+=batch;
+        }
+        double const seconds=std::chrono::duration<double>(
+            std::chrono::steady_clock::now()-start).count();
+        std::printf("batch %2zu: %9.0f verifications/s (%zu/%zu ok)\n",
+                    batch,done/seconds,ok,done);
+    }
+}
@@ -0,0 +1,59 @@
+//两个receiver之间乒乓往返的吞吐，比较不绑核和绑核
+//用法：placement_bench [CPU列表，同ATM_CPUS格式，前两个分别给主线程和对端]
+#include "message.hpp"
+#include "placement.hpp"
+#include <chrono>
+#include <cstdio>
+
+struct ping
+{};
+struct pong
+{};
+
+struct echo
+{
+    messaging::receiver incoming;
+    messaging::sender peer;
+    int rounds;
+    void run()
+    {
+        for(int i=0;i<rounds;++i)
+        {
+            incoming.wait()
+                .handle<ping>(
+                    [&](ping const& msg)
+                    {
+                        peer.send(pong());
+                    }
+                    );
+        }
+    }
+};
+
+int main(int argc,char** argv)
+{
+    char const* spec=argc>1?argv[1]:nullptr;
+    std::vector<int> const cpus=messaging::parse_cpu_list(spec,2);
+    int const rounds=200000;
+    messaging::receiver incoming;
+    echo peer;
+    peer.rounds=rounds;
+    peer.peer=incoming;
+    messaging::pin_current_thread(cpus[0]);
+    std::thread t=messaging::launch(peer,"echo",cpus[1]);
+    messaging::sender to_peer=peer.incoming;
+    auto const start=std::chrono::steady_clock::now();
+    for(int i=0;i<rounds;++i)
+    {
+        to_peer.send(ping());
+        incoming.wait()
+            .handle<pong>(
+                [&](pong const& msg)
+                {}
+                );
+    }
+    double const seconds=std::chrono::duration<double>(
+        std::chrono::steady_clock::now()-start).count();
+    t.join();
+    std::printf("%s: %.0f round trips/s\n",spec?spec:"unpinned",rounds/seconds);
+}
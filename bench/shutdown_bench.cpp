@@ -0,0 +1,31 @@
+//bank邮箱里已经排着10万条withdrawal_processed时，不同deadline下done()到run()返回的时间
+#include "action.hpp"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+typedef std::chrono::steady_clock clock_type;
+
+static void run(char const* name,clock_type::duration after)
+{
+    int const backlog=100000;
+    bank_machine bank;
+    messaging::sender to_bank=bank.get_sender();
+    for(int i=0;i<backlog;++i)
+    {
+        to_bank.send(withdrawal_processed("acc1234",1));
+    }
+    clock_type::time_point const start=clock_type::now();
+    bank.done(after==clock_type::duration::max()?clock_type::time_point::max():start+after);
+    std::thread t(&bank_machine::run,&bank);
+    t.join();
+    std::printf("deadline = %-6s %6.1f ms\n",name,
+                std::chrono::duration<double,std::milli>(clock_type::now()-start).count());
+}
+
+int main()
+{
+    run("max",clock_type::duration::max());
+    run("+10ms",std::chrono::milliseconds(10));
+    run("now",clock_type::duration::zero());
+}
@@ -0,0 +1,47 @@
+//向1、4、16个订阅者扇出时，逐个send与topic::publish的发送端开销
+#include "message.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct withdrawal_processed
+{
+    std::string account;
+    unsigned amount;
+};
+
+int main()
+{
+    int const messages=100000;
+    for(int subscribers:{1,4,16})
+    {
+        std::vector<messaging::receiver> receivers(subscribers);
+        messaging::topic topic;
+        std::vector<messaging::sender> senders;
+        for(auto& r:receivers)
+        {
+            topic.subscribe(r);
+            senders.push_back(r);
+        }
+        withdrawal_processed const msg{"account-with-a-long-name-1234",50};
+        auto const t0=std::chrono::steady_clock::now();
+        for(int i=0;i<messages;++i)
+        {
+            for(auto& s:senders)
+            {
+                s.send(msg);
+            }
+        }
+        auto const t1=std::chrono::steady_clock::now();
+        for(int i=0;i<messages;++i)
+        {
+            topic.publish(msg);
+        }
+        auto const t2=std::chrono::steady_clock::now();
+        std::printf("%2d subscribers: send per receiver %6.0f ns/msg  publish %6.0f ns/msg\n",
+                    subscribers,
+                    std::chrono::duration<double,std::nano>(t1-t0).count()/messages,
+                    std::chrono::duration<double,std::nano>(t2-t1).count()/messages);
+    }
+}
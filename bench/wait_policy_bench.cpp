@@ -0,0 +1,86 @@
+//不同wait_policy下两个receiver之间往返延迟的p50/p99，以及CPU时间/墙钟时间
+#include "message.hpp"
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+struct ping
+{};
+struct pong
+{};
+
+struct echo
+{
+    messaging::receiver incoming;
+    messaging::sender peer;
+    int rounds;
+    explicit echo(messaging::wait_policy policy):
+        incoming(policy)
+    {}
+    void run()
+    {
+        for(int i=0;i<rounds;++i)
+        {
+            incoming.wait()
+                .handle<ping>(
+                    [&](ping const& msg)
+                    {
+                        peer.send(pong());
+                    }
+                    );
+        }
+    }
+};
+
+static double cpu_seconds()
+{
+    rusage r;
+    getrusage(RUSAGE_SELF,&r);
+    return r.ru_utime.tv_sec+r.ru_stime.tv_sec+
+        (r.ru_utime.tv_usec+r.ru_stime.tv_usec)/1e6;
+}
+
+static void run(char const* name,messaging::wait_policy policy)
+{
+    int const rounds=50000;
+    echo peer(policy);
+    peer.rounds=rounds;
+    messaging::receiver incoming(policy);
+    peer.peer=incoming;
+    std::thread t(&echo::run,&peer);
+    messaging::sender to_peer=peer.incoming;
+    std::vector<double> latencies;
+    latencies.reserve(rounds);
+    double const cpu0=cpu_seconds();
+    auto const start=std::chrono::steady_clock::now();
+    for(int i=0;i<rounds;++i)
+    {
+        auto const sent=std::chrono::steady_clock::now();
+        to_peer.send(ping());
+        incoming.wait()
+            .handle<pong>(
+                [&](pong const& msg)
+                {}
+                );
+        latencies.push_back(std::chrono::duration<double,std::micro>(
+            std::chrono::steady_clock::now()-sent).count());
+    }
+    double const wall=std::chrono::duration<double>(
+        std::chrono::steady_clock::now()-start).count();
+    t.join();
+    double const cpu=cpu_seconds()-cpu0;
+    std::sort(latencies.begin(),latencies.end());
+    std::printf("%-10s p50 %7.2fus  p99 %8.2fus  cpu/wall %.2f\n",name,
+                latencies[rounds/2],latencies[rounds*99/100],cpu/wall);
+}
+
+int main()
+{
+    run("blocking",messaging::wait_policy::blocking());
+    run("yield",messaging::wait_policy::spinning(0,200));
+    run("spinning",messaging::wait_policy::spinning());
+    //绕过spinning()在单核上去掉自旋的保护，直接构造，对应表中"forced 20k spin"一行
+    run("forced",messaging::wait_policy{20000,200});
+}
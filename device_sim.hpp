@@ -0,0 +1,652 @@
+#pragma once
+#include "action.hpp"
+#include "placement.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//设备模拟：从workload文件读取每个终端的输入序列，注入到多个atm中，
+//记录每个会话从插卡到退卡的延迟
+//
+//workload文件格式(一行一条，#开头为注释)：
+//  account <账户> <PIN> <余额>
+//  <终端号> card <账户>       插卡，开始一个新会话
+//  <终端号> pin <数字串>      按下若干个数字键
+//  <终端号> withdraw <金额>
+//  <终端号> balance
+//  <终端号> cancel
+//  <终端号> think <毫秒>      两次输入之间的停顿
+namespace device_sim
+{
+    typedef std::chrono::steady_clock clock;
+
+    struct input_event
+    {
+        enum kind_type {card,digit,withdraw,balance,cancel,think};
+        kind_type kind;
+        std::string account;
+        unsigned value;//digit的字符、withdraw的金额或think的毫秒数
+    };
+
+    //只读映射整个文件，按顺序扫描
+    class mapped_file
+    {
+        void* data;
+        std::size_t length;
+
+        mapped_file(mapped_file const&)=delete;
+        mapped_file& operator=(mapped_file const&)=delete;
+    public:
+        explicit mapped_file(char const* path):
+            data(nullptr),length(0)
+        {
+            int fd=::open(path,O_RDONLY);
+            if(fd<0)
+            {
+                throw std::runtime_error(std::string("cannot open ")+path);
+            }
+            struct stat st;
+            if(::fstat(fd,&st)==0 && st.st_size>0)
+            {
+                length=static_cast<std::size_t>(st.st_size);
+                data=::mmap(nullptr,length,PROT_READ,MAP_PRIVATE,fd,0);
+            }
+            ::close(fd);
+            if(data==MAP_FAILED)
+            {
+                throw std::runtime_error(std::string("cannot map ")+path);
+            }
+            if(data)
+            {
+                ::madvise(data,length,MADV_SEQUENTIAL);
+            }
+        }
+        ~mapped_file()
+        {
+            if(data)
+            {
+                ::munmap(data,length);
+            }
+        }
+        char const* begin() const
+        {
+            return static_cast<char const*>(data);
+        }
+        char const* end() const
+        {
+            return begin()+length;
+        }
+    };
+
+    //把一行切成空白分隔的词，#之后为注释；返回下一行的开头
+    inline char const* split_line(char const* p,char const* end,
+                                  std::vector<std::string>& tokens)
+    {
+        char const* eol=static_cast<char const*>(std::memchr(p,'\n',end-p));
+        if(!eol)
+        {
+            eol=end;
+        }
+        tokens.clear();
+        for(char const* q=p;q<eol;)
+        {
+            while(q<eol && std::isspace(static_cast<unsigned char>(*q)))
+                ++q;
+            if(q==eol || *q=='#')
+                break;
+            char const* start=q;
+            while(q<eol && !std::isspace(static_cast<unsigned char>(*q)))
+                ++q;
+            tokens.emplace_back(start,q);
+        }
+        return eol<end?eol+1:end;
+    }
+
+    inline bool parse_number(std::string const& s,unsigned& value)
+    {
+        char* e=nullptr;
+        errno=0;
+        unsigned long const v=std::strtoul(s.c_str(),&e,10);
+        if(s.empty() || !std::isdigit(static_cast<unsigned char>(s[0])) || *e ||
+           errno || v>~0u)
+        {
+            return false;
+        }
+        value=static_cast<unsigned>(v);
+        return true;
+    }
+
+    //workload文件：构造时扫描一遍，校验格式、读出账户、给终端号分配连续的下标，
+    //并为每个终端记下它各行在映射里的位置；会话本身不读进内存，
+    //由各终端的session_reader在运行时只按自己的行逐个解析
+    class workload
+    {
+    public:
+        struct account
+        {
+            std::string id;
+            std::string pin;
+            unsigned balance;
+        };
+        struct terminal
+        {
+            unsigned id;                   //文件里的终端号
+            std::vector<char const*> lines;//该终端各行的开头，按文件顺序
+            std::size_t sessions;
+        };
+    private:
+        mapped_file file;
+        std::vector<account> accounts_;
+        std::vector<terminal> terminals_;
+    public:
+        explicit workload(char const* path):
+            file(path)
+        {
+            std::unordered_map<unsigned,std::size_t> index;//终端号到下标
+            std::vector<std::string> tokens;
+            unsigned line_no=0;
+            for(char const* p=file.begin();p<file.end();)
+            {
+                char const* const line=p;
+                p=split_line(p,file.end(),tokens);
+                ++line_no;
+                if(tokens.empty())
+                {
+                    continue;
+                }
+                auto fail=[&](char const* what)
+                {
+                    throw std::runtime_error(std::string(path)+":"+
+                        std::to_string(line_no)+": "+what);
+                };
+                auto number=[&](std::string const& s)
+                {
+                    unsigned v=0;
+                    if(!parse_number(s,v))
+                    {
+                        fail("expected a number");
+                    }
+                    return v;
+                };
+                if(tokens[0]=="account")
+                {
+                    if(tokens.size()!=4)
+                    {
+                        fail("usage: account <id> <pin> <balance>");
+                    }
+                    accounts_.push_back(account{tokens[1],tokens[2],number(tokens[3])});
+                    continue;
+                }
+                if(tokens.size()<2)
+                {
+                    fail("usage: <terminal> <event> [arg]");
+                }
+                unsigned const id=number(tokens[0]);
+                auto it=index.find(id);
+                if(it==index.end())
+                {
+                    it=index.emplace(id,terminals_.size()).first;
+                    terminals_.push_back(terminal{id,{},0});
+                }
+                terminal& t=terminals_[it->second];
+                t.lines.push_back(line);
+                std::string const& kind=tokens[1];
+                if(kind=="card")
+                {
+                    if(tokens.size()!=3)
+                    {
+                        fail("usage: <terminal> card <account>");
+                    }
+                    ++t.sessions;
+                    continue;
+                }
+                if(!t.sessions)
+                {
+                    fail("event before the terminal's first card");
+                }
+                if(kind=="pin" && tokens.size()==3)
+                {
+                }
+                else if((kind=="withdraw" || kind=="think") && tokens.size()==3)
+                {
+                    number(tokens[2]);
+                }
+                else if((kind=="balance" || kind=="cancel") && tokens.size()==2)
+                {
+                }
+                else
+                {
+                    fail("unknown event");
+                }
+            }
+        }
+        std::vector<account> const& accounts() const
+        {
+            return accounts_;
+        }
+        std::vector<terminal> const& terminals() const
+        {
+            return terminals_;
+        }
+        char const* end() const
+        {
+            return file.end();
+        }
+    };
+
+    struct session
+    {
+        std::vector<input_event> events;
+    };
+
+    //按顺序读出一个终端的会话，每次只解析一个；文件已经在workload构造时校验过
+    //只访问该终端自己的行，总的解析量与文件大小成正比，与终端数无关
+    class session_reader
+    {
+        std::vector<char const*> const& lines;
+        char const* end;
+        std::size_t next_line;
+        std::vector<std::string> tokens;
+    public:
+        session_reader(workload const& w,std::size_t terminal):
+            lines(w.terminals()[terminal].lines),end(w.end()),next_line(0)
+        {}
+        //读出下一个会话，没有更多会话返回false
+        bool next(session& s)
+        {
+            s.events.clear();
+            for(;next_line<lines.size();++next_line)
+            {
+                split_line(lines[next_line],end,tokens);
+                std::string const& kind=tokens[1];
+                if(kind=="card")
+                {
+                    if(!s.events.empty())
+                    {
+                        return true;//下一个会话的开头，留给下一次next()
+                    }
+                    s.events.push_back(input_event{input_event::card,tokens[2],0});
+                }
+                else if(kind=="pin")
+                {
+                    for(char d:tokens[2])
+                    {
+                        s.events.push_back(input_event{input_event::digit,"",
+                                                       static_cast<unsigned>(d)});
+                    }
+                }
+                else if(kind=="withdraw" || kind=="think")
+                {
+                    unsigned v=0;
+                    parse_number(tokens[2],v);
+                    s.events.push_back(input_event{kind=="withdraw"?input_event::withdraw:
+                                                   input_event::think,"",v});
+                }
+                else
+                {
+                    s.events.push_back(input_event{kind=="balance"?input_event::balance:
+                                                   input_event::cancel,"",0});
+                }
+            }
+            return !s.events.empty();
+        }
+    };
+
+    //模拟的终端硬件：代替interface_machine接收atm的显示和出钞消息
+    class terminal_device
+    {
+    public:
+        enum screen {busy,enter_card,enter_pin,options};
+        struct outcome_counts
+        {
+            unsigned issued;
+            unsigned insufficient;
+            unsigned pin_incorrect;
+            unsigned throttled;
+            unsigned cancelled;
+        };
+    private:
+        messaging::receiver incoming;
+        std::mutex m;
+        std::condition_variable c;
+        screen current;
+        unsigned ejects;
+        clock::time_point last_eject;
+        outcome_counts counts;
+
+        void show(screen s)
+        {
+            std::lock_guard<std::mutex> lk(m);
+            current=s;
+            c.notify_all();
+        }
+    public:
+        terminal_device():
+            current(busy),ejects(0),counts()
+        {}
+        void done(clock::time_point deadline=clock::time_point::max())
+        {
+            incoming.close(deadline);
+        }
+        void run()
+        {
+            while(!incoming.closed())
+            {
+                incoming.wait()
+                    .handle<issue_money>(
+                        [&](issue_money const& msg)
+                        {
+                            ++counts.issued;
+                        }
+                        )
+                    .handle<display_insufficient_funds>(
+                        [&](display_insufficient_funds const& msg)
+                        {
+                            ++counts.insufficient;
+                        }
+                        )
+                    .handle<display_enter_pin>(
+                        [&](display_enter_pin const& msg)
+                        {
+                            show(enter_pin);
+                        }
+                        )
+                    .handle<display_enter_card>(
+                        [&](display_enter_card const& msg)
+                        {
+                            show(enter_card);
+                        }
+                        )
+                    .handle<display_balance>(
+                        [&](display_balance const& msg)
+                        {
+                        }
+                        )
+                    .handle<display_withdrawal_options>(
+                        [&](display_withdrawal_options const& msg)
+                        {
+                            show(options);
+                        }
+                        )
+                    .handle<display_withdrawal_cancelled>(
+                        [&](display_withdrawal_cancelled const& msg)
+                        {
+                            ++counts.cancelled;
+                        }
+                        )
+                    .handle<display_pin_incorrect_message>(
+                        [&](display_pin_incorrect_message const& msg)
+                        {
+                            ++counts.pin_incorrect;
+                        }
+                        )
+                    .handle<display_request_throttled>(
+                        [&](display_request_throttled const& msg)
+                        {
+                            ++counts.throttled;
+                        }
+                        )
+                    .handle<eject_card>(
+                        [&](eject_card const& msg)
+                        {
+                            std::lock_guard<std::mutex> lk(m);
+                            ++ejects;
+                            last_eject=clock::now();
+                            current=busy;
+                            c.notify_all();
+                        }
+                        );
+            }
+        }
+        messaging::sender get_sender()
+        {
+            return incoming;
+        }
+        //发出会改变屏幕的输入之前调用，避免把旧的屏幕当成新的
+        void expect_change()
+        {
+            std::lock_guard<std::mutex> lk(m);
+            current=busy;
+        }
+        unsigned eject_count()
+        {
+            std::lock_guard<std::mutex> lk(m);
+            return ejects;
+        }
+        //等待屏幕变为s；会话期间退卡(ejects变化)或超时返回false
+        bool wait_for(screen s,unsigned ejects_before,clock::time_point deadline)
+        {
+            std::unique_lock<std::mutex> lk(m);
+            c.wait_until(lk,deadline,[&]{return current==s || ejects!=ejects_before;});
+            return current==s && ejects==ejects_before;
+        }
+        //等待第ejects_before+1次退卡，返回退卡时刻；超时返回false
+        bool wait_for_eject(unsigned ejects_before,clock::time_point deadline,
+                            clock::time_point& when)
+        {
+            std::unique_lock<std::mutex> lk(m);
+            if(!c.wait_until(lk,deadline,[&]{return ejects!=ejects_before;}))
+            {
+                return false;
+            }
+            when=last_eject;
+            return true;
+        }
+        outcome_counts outcomes() const//run()结束之后调用
+        {
+            return counts;
+        }
+    };
+
+    struct run_options
+    {
+        double open_rate;//>0：开环，每个终端每秒开始open_rate个会话；0：闭环
+        bool unthrottled;
+        std::chrono::milliseconds session_timeout;
+        char const* cpus;//绑核，格式同ATM_CPUS，顺序为 bank,atm0,term0,atm1,term1,...；nullptr不绑定
+    };
+
+    struct terminal_result
+    {
+        std::vector<double> latencies_us;
+        unsigned timeouts;
+    };
+
+    //按会话顺序驱动一个终端
+    //闭环：上一个会话退卡后立即开始下一个，延迟从插卡算起；
+    //开环：会话按固定间隔到达，终端忙时排队，延迟从计划到达时刻算起(包含排队时间)
+    inline void drive_terminal(workload const& w,std::size_t terminal,
+                               messaging::sender atm_queue,terminal_device& device,
+                               run_options const& opts,clock::time_point start,
+                               terminal_result& result)
+    {
+        result.timeouts=0;
+        result.latencies_us.reserve(w.terminals()[terminal].sessions);
+        session_reader reader(w,terminal);
+        session current;
+        for(std::size_t k=0;reader.next(current);++k)
+        {
+            clock::time_point arrival=clock::now();
+            if(opts.open_rate>0)
+            {
+                arrival=start+std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>(k/opts.open_rate));
+                std::this_thread::sleep_until(arrival);
+            }
+            clock::time_point const deadline=
+                std::max(arrival,clock::now())+opts.session_timeout;
+            unsigned const e0=device.eject_count();
+            //atm没有回到插卡界面时不能插卡，这个会话算超时
+            if(!device.wait_for(terminal_device::enter_card,e0,deadline))
+            {
+                ++result.timeouts;
+                continue;
+            }
+            clock::time_point const inserted=clock::now();
+            bool in_session=true;
+            for(input_event const& ev:current.events)
+            {
+                if(!in_session)
+                    break;
+                switch(ev.kind)
+                {
+                case input_event::card:
+                    device.expect_change();
+                    atm_queue.send(card_inserted(ev.account));
+                    break;
+                case input_event::digit:
+                    in_session=device.wait_for(terminal_device::enter_pin,e0,deadline);
+                    if(in_session)
+                        atm_queue.send(digit_pressed(static_cast<char>(ev.value)));
+                    break;
+                case input_event::withdraw:
+                case input_event::balance:
+                    in_session=device.wait_for(terminal_device::options,e0,deadline);
+                    if(!in_session)
+                        break;
+                    device.expect_change();
+                    if(ev.kind==input_event::withdraw)
+                        atm_queue.send(withdraw_pressed(ev.value));
+                    else
+                        atm_queue.send(balance_pressed());
+                    break;
+                case input_event::cancel:
+                    device.expect_change();
+                    atm_queue.send(cancel_pressed());
+                    break;
+                case input_event::think:
+                    std::this_thread::sleep_for(std::chrono::milliseconds(ev.value));
+                    break;
+                }
+            }
+            //序列结束时卡还在机器里：回到选项界面就按取消
+            if(device.eject_count()==e0)
+            {
+                device.wait_for(terminal_device::options,e0,deadline);
+                if(device.eject_count()==e0)
+                    atm_queue.send(cancel_pressed());
+            }
+            clock::time_point ejected;
+            if(!device.wait_for_eject(e0,deadline+opts.session_timeout,ejected))
+            {
+                ++result.timeouts;
+                continue;
+            }
+            clock::time_point const from=opts.open_rate>0?arrival:inserted;
+            result.latencies_us.push_back(
+                std::chrono::duration<double,std::micro>(ejected-from).count());
+        }
+    }
+
+    inline int run(workload const& w,run_options const& opts)
+    {
+        std::size_t const n=w.terminals().size();
+        //"auto"时同一终端的atm和设备线程拿到拓扑上相邻的两个CPU
+        std::vector<int> const cpus=messaging::parse_cpu_list(opts.cpus,1+2*n);
+        //各状态机在自己的线程上构造，账户表、限流表和邮箱落在该线程的NUMA节点上
+        admission_limits const limits=opts.unthrottled?
+            admission_limits{1e6,1e6,~0u,std::chrono::microseconds(0)}:
+            bank_machine::default_limits();
+        messaging::placed_machine<bank_machine> bank("bank",cpus[0],
+            [&w](bank_machine& b)
+            {
+                for(auto const& a:w.accounts())
+                {
+                    b.open_account(a.id,a.pin,a.balance);
+                }
+            },
+            limits);
+        std::vector<std::unique_ptr<messaging::placed_machine<terminal_device> > > devices;
+        std::vector<std::unique_ptr<messaging::placed_machine<atm> > > atms;
+        for(std::size_t i=0;i<n;++i)
+        {
+            devices.emplace_back(new messaging::placed_machine<terminal_device>(
+                "term",cpus[2+2*i],messaging::no_setup()));
+            atms.emplace_back(new messaging::placed_machine<atm>(
+                "atm",cpus[1+2*i],messaging::no_setup(),
+                bank->get_sender(),(*devices[i])->get_sender()));
+        }
+
+        std::vector<terminal_result> results(n);
+        std::vector<std::thread> drivers;
+        clock::time_point const start=clock::now();
+        for(std::size_t i=0;i<n;++i)
+        {
+            drivers.emplace_back(drive_terminal,std::cref(w),i,
+                                 (*atms[i])->get_sender(),std::ref(**devices[i]),
+                                 std::cref(opts),start,std::ref(results[i]));
+        }
+        for(auto& t:drivers)
+        {
+            t.join();
+        }
+        double const elapsed=std::chrono::duration<double>(clock::now()-start).count();
+
+        clock::time_point const atm_deadline=clock::now()+std::chrono::seconds(2);
+        for(auto& a:atms)
+        {
+            (*a)->done(atm_deadline);
+        }
+        for(auto& a:atms)
+        {
+            a->join();
+        }
+        //所有atm都退出之后再给bank和设备计时，atm最后发出的消息不会因此被丢弃
+        clock::time_point const deadline=clock::now()+std::chrono::seconds(2);
+        bank->done(deadline);
+        for(auto& d:devices)
+        {
+            (*d)->done(deadline);
+        }
+        bank.join();
+        for(auto& d:devices)
+        {
+            d->join();
+        }
+
+        std::vector<double> all;
+        unsigned timeouts=0;
+        terminal_device::outcome_counts total=terminal_device::outcome_counts();
+        for(std::size_t i=0;i<n;++i)
+        {
+            all.insert(all.end(),results[i].latencies_us.begin(),results[i].latencies_us.end());
+            timeouts+=results[i].timeouts;
+            terminal_device::outcome_counts const c=(*devices[i])->outcomes();
+            total.issued+=c.issued;
+            total.insufficient+=c.insufficient;
+            total.pin_incorrect+=c.pin_incorrect;
+            total.throttled+=c.throttled;
+            total.cancelled+=c.cancelled;
+        }
+        std::sort(all.begin(),all.end());
+        auto pct=[&](double q)
+        {
+            return all.empty()?0.0:all[std::min(all.size()-1,
+                static_cast<std::size_t>(q*all.size()))]/1000.0;
+        };
+        std::printf("%s loop, %zu terminals, %zu sessions in %.3fs (%.0f sessions/s), %u timed out\n",
+                    opts.open_rate>0?"open":"closed",n,all.size(),elapsed,
+                    all.size()/elapsed,timeouts);
+        std::printf("card insert to eject (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+                    pct(0.5),pct(0.9),pct(0.99),all.empty()?0.0:all.back()/1000.0);
+        std::printf("issued %u, insufficient %u, pin incorrect %u, throttled %u, cancelled %u\n",
+                    total.issued,total.insufficient,total.pin_incorrect,
+                    total.throttled,total.cancelled);
+        return timeouts?1:0;
+    }
+}
@@ -1,20 +1,81 @@
 #include "action.hpp"
+#include "placement.hpp"
+#include "device_sim.hpp"
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <thread>
 
-int main()
+//ATM <workload> [--open <每终端每秒会话数>] [--unthrottled]
+int simulate(int argc,char** argv)
 {
-    bank_machine bank;
-    interface_machine interface_hardware;
-    atm machine(bank.get_sender(),interface_hardware.get_sender());
-    std::thread bank_thread(&bank_machine::run,&bank);
-    std::thread if_thread(&interface_machine::run,&interface_hardware);
-    std::thread atm_thread(&atm::run,&machine);
+    device_sim::run_options opts{0,false,std::chrono::milliseconds(5000),std::getenv("ATM_CPUS")};
+    for(int i=2;i<argc;++i)
+    {
+        if(!std::strcmp(argv[i],"--open") && i+1<argc)
+        {
+            char const* rate=argv[++i];
+            char* end=nullptr;
+            errno=0;
+            opts.open_rate=std::strtod(rate,&end);
+            if(end==rate || *end || errno || !(opts.open_rate>0) ||
+               opts.open_rate==HUGE_VAL)
+            {
+                std::cerr<<"--open expects a positive number of sessions/s, got \""
+                         <<rate<<"\""<<std::endl;
+                return 2;
+            }
+        }
+        else if(!std::strcmp(argv[i],"--unthrottled"))
+        {
+            opts.unthrottled=true;
+        }
+        else
+        {
+            std::cerr<<"usage: "<<argv[0]
+                     <<" <workload> [--open <sessions/s per terminal>] [--unthrottled]"
+                     <<std::endl;
+            return 2;
+        }
+    }
+    try
+    {
+        device_sim::workload const w(argv[1]);
+        return device_sim::run(w,opts);
+    }
+    catch(std::exception const& e)
+    {
+        std::cerr<<e.what()<<std::endl;
+        return 2;
+    }
+}
 
-    pthread_setname_np(bank_thread.native_handle(), "bank"); 
-    pthread_setname_np(if_thread.native_handle(), "if"); 
-    pthread_setname_np(atm_thread.native_handle(), "atm"); 
+int main(int argc,char** argv)
+{
+    if(argc>1)
+    {
+        return simulate(argc,argv);
+    }
+    //ATM_CPUS="bank,atm,if" 指定绑核，"auto" 按拓扑使用相邻核；不设置则不绑定
+    //atm与bank、interface都有往返消息，放在中间
+    std::vector<int> cpus;
+    try
+    {
+        cpus=messaging::parse_cpu_list(std::getenv("ATM_CPUS"),3);
+    }
+    catch(std::invalid_argument const& e)
+    {
+        std::cerr<<"ATM_CPUS: "<<e.what()<<std::endl;
+        return 2;
+    }
+    //每个状态机在绑核后的线程上构造，构造时分配的内存按first-touch落在该CPU的NUMA节点上
+    messaging::placed_machine<bank_machine> bank("bank",cpus[0],messaging::no_setup());
+    messaging::placed_machine<interface_machine> interface_hardware("if",cpus[2],messaging::no_setup());
+    messaging::placed_machine<atm> machine("atm",cpus[1],messaging::no_setup(),
+                                           bank->get_sender(),interface_hardware->get_sender());
 
-    messaging::sender atmqueue(machine.get_sender());
+    messaging::sender atmqueue(machine->get_sender());
     bool quit_pressed=false;
     while(!quit_pressed)
     {
@@ -50,10 +111,15 @@ int main()
             break;
         }
     }
-    bank.done();
-    machine.done();
-    interface_hardware.done();
-    atm_thread.join();
-    bank_thread.join();
-    if_thread.join();
+    //输入已经停止；先关atm，让它完成在途的交易(bank和interface仍在运行)，
+    //atm退出后不再有消息发往bank和interface，再关闭它们
+    //bank和interface的deadline在atm退出之后另算，否则atm最后发出的
+    //cancel_withdrawal和eject_card可能因为共用的deadline已过而被丢弃
+    machine->done(std::chrono::steady_clock::now()+std::chrono::seconds(2));
+    machine.join();
+    auto const deadline=std::chrono::steady_clock::now()+std::chrono::seconds(2);
+    bank->done(deadline);
+    interface_hardware->done(deadline);
+    bank.join();
+    interface_hardware.join();
 }
@@ -1,14 +1,67 @@
+#pragma once
 #include <mutex>
 #include <condition_variable>
 #include <queue>
 #include <memory>
 #include <iostream>
 #include <atomic>
-#include <typeinfo>
+#include <utility>
+#include <type_traits>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 namespace messaging
 {
+    inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    //接收等待策略：先自旋spin次，再yield次让出CPU，最后在条件变量上休眠
+    //默认直接休眠；对延迟敏感的状态机(如bank)可以用spinning()
+    struct wait_policy
+    {
+        unsigned spin;
+        unsigned yield;
+        static wait_policy blocking()
+        {
+            return wait_policy{0,0};
+        }
+        static wait_policy spinning(unsigned spin_=20000,unsigned yield_=200)
+        {
+            //单核上自旋只会拖住对端线程，直接从yield开始
+            if(std::thread::hardware_concurrency()<2)
+            {
+                spin_=0;
+            }
+            return wait_policy{spin_,yield_};
+        }
+    };
+
+    //每种消息类型一个唯一的地址作为类型ID，派发时比较指针，不需要dynamic_cast
+    //id不能是const：值相同的常量可能被编译器或链接器合并到同一地址
+    template<typename Msg>
+    struct message_type
+    {
+        static char id;
+    };
+    template<typename Msg>
+    char message_type<Msg>::id=0;
+
     struct message_base
     {
+        void const* const type;
+        explicit message_base(void const* type_):
+            type(type_)
+        {}
         virtual ~message_base()
         {}
     };
@@ -19,29 +72,136 @@ namespace messaging
     {
         Msg contents;
         explicit wrapped_message(Msg const& contents_):
+            message_base(&message_type<Msg>::id),
             contents(contents_)
         {}
     };
 
+    class close_queue
+    {};
+
     class queue
     {
         std::mutex m;
         std::condition_variable c;
         std::queue<std::shared_ptr<message_base> > q;
+        std::atomic<std::size_t> count;//无锁读取，供自旋等待使用
+        unsigned sleepers;//在条件变量上休眠的消费者数，受m保护
+        wait_policy policy;
+        //关闭：close()在队尾放入close_marker，消费者取到它之后closed为true
+        //deadline之前照常处理marker之前的消息；过了deadline还没取到marker，丢弃marker之前的消息
+        std::shared_ptr<message_base> close_marker;
+        std::chrono::steady_clock::time_point deadline;
+        std::atomic<bool> closed_;
+
+        void discard_until_marker()
+        {
+            while(!q.empty() && q.front()!=close_marker)
+            {
+                q.pop();
+            }
+        }
+
+        void spin_until_ready()
+        {
+            for(unsigned i=0;i<policy.spin;++i)
+            {
+                if(count.load(std::memory_order_acquire))
+                    return;
+                cpu_relax();
+            }
+            for(unsigned i=0;i<policy.yield;++i)
+            {
+                if(count.load(std::memory_order_acquire))
+                    return;
+                std::this_thread::yield();
+            }
+        }
     public:
+        explicit queue(wait_policy policy_=wait_policy::blocking()):
+            count(0),sleepers(0),policy(policy_),
+            deadline(std::chrono::steady_clock::time_point::max()),
+            closed_(false)
+        {}
         template<typename T>
         void push(T const& msg)
+        {
+            push_shared(std::make_shared<wrapped_message<T> >(msg));
+        }
+        void push_shared(std::shared_ptr<message_base> const& msg)
         {
             std::lock_guard<std::mutex> lk(m);
-            q.push(std::make_shared<wrapped_message<T> >(msg));
+            q.push(msg);
+            count.store(q.size(),std::memory_order_release);
+            if(sleepers)//自旋中的消费者不需要唤醒
+            {
+                c.notify_all();
+            }
+        }
+        bool empty() const
+        {
+            return count.load(std::memory_order_acquire)==0;
+        }
+        void close(std::chrono::steady_clock::time_point deadline_)
+        {
+            std::lock_guard<std::mutex> lk(m);
+            if(close_marker)
+            {
+                return;
+            }
+            deadline=deadline_;
+            close_marker=std::make_shared<wrapped_message<close_queue> >(close_queue());
+            q.push(close_marker);
+            count.store(q.size(),std::memory_order_release);
             c.notify_all();
         }
+        bool closed() const
+        {
+            return closed_.load(std::memory_order_acquire);
+        }
+        //已关闭且超过deadline，在途的请求不必再等
+        bool expired() const
+        {
+            return closed() && std::chrono::steady_clock::now()>=deadline;
+        }
         std::shared_ptr<message_base> wait_and_pop()
         {
+            spin_until_ready();
             std::unique_lock<std::mutex> lk(m);
-            c.wait(lk,[&]{return !q.empty();});
+            for(;;)
+            {
+                if(close_marker && !closed_ &&
+                   std::chrono::steady_clock::now()>=deadline)
+                {
+                    discard_until_marker();
+                }
+                if(!q.empty())
+                {
+                    break;
+                }
+                ++sleepers;
+                if(closed_ && deadline!=std::chrono::steady_clock::time_point::max())
+                {
+                    //关闭后只等在途的回复，到期后再交出一次close_queue
+                    bool const timeout=
+                        c.wait_until(lk,deadline)==std::cv_status::timeout;
+                    --sleepers;
+                    if(timeout && q.empty())
+                    {
+                        return close_marker;
+                    }
+                    continue;
+                }
+                c.wait(lk);
+                --sleepers;
+            }
             auto res=q.front();
             q.pop();
+            count.store(q.size(),std::memory_order_release);
+            if(res==close_marker)
+            {
+                closed_.store(true,std::memory_order_release);
+            }
             return res;
         }
     };
@@ -49,6 +209,7 @@ namespace messaging
     class sender
     {
         queue*q;
+        friend class topic;
     public:
         sender():
             q(nullptr)
@@ -56,6 +217,10 @@ namespace messaging
         explicit sender(queue*q_):
             q(q_)
         {}
+        void const* id() const//同一个receiver的sender有相同的id
+        {
+            return q;
+        }
         template<typename Message>
         void send(Message const& msg)
         {
@@ -66,145 +231,156 @@ namespace messaging
         }
     };
 
-    static std::atomic_int t_idx {0};
-    template<typename PreviousDispatcher,typename Msg,typename Func>
-    class TemplateDispatcher
+    //广播：消息只构造一次，所有订阅者的队列共享同一个shared_ptr
+    //每个订阅者有自己的队列，慢的订阅者不会阻塞快的
+    //topic只保存订阅者队列的裸指针：receiver析构之前必须先unsubscribe，否则publish会写到已释放的队列
+    class topic
     {
-        queue* q;
-        PreviousDispatcher* prev;
-        Func f;
-        bool chained;
-        int idx;
-
-        TemplateDispatcher(TemplateDispatcher const&)=delete;
-        TemplateDispatcher& operator=(TemplateDispatcher const&)=delete;
-
-        template<typename Dispatcher,typename OtherMsg,typename OtherFunc>
-        friend class TemplateDispatcher;//TemplateDispatcher instantiations are friends of each other.
-
-        void wait_and_dispatch()
+        std::mutex m;
+        std::vector<queue*> subscribers;
+    public:
+        void subscribe(sender s)
         {
-            for(;;)
+            if(s.q)
             {
-                auto msg=q->wait_and_pop();
-                if(dispatch(msg)) //成功处理过一次消息后，会跳出循环
-                    break;
-                //std::cout << "next wait" << std::endl;
+                std::lock_guard<std::mutex> lk(m);
+                subscribers.push_back(s.q);
             }
         }
-
-        bool dispatch(std::shared_ptr<message_base> const& msg)
+        void unsubscribe(sender s)
         {
-            if(wrapped_message<Msg>* wrapper=
-               dynamic_cast<wrapped_message<Msg>*>(msg.get()))
-            {
-                f(wrapper->contents);
-                return true;
-            }
-            else
-            {
-                return prev->dispatch(msg);// 链接到之前的派发器上
-            }
+            std::lock_guard<std::mutex> lk(m);
+            subscribers.erase(
+                std::remove(subscribers.begin(),subscribers.end(),s.q),
+                subscribers.end());
         }
-    public:
-        TemplateDispatcher(TemplateDispatcher&& other):
-            q(other.q),prev(other.prev),f(std::move(other.f)),
-            chained(other.chained)
+        template<typename Message>
+        void publish(Message const& msg)
         {
-            idx = ++t_idx;
-            //std::cout << "move TemplateDispatcher: " << idx << std::endl;
-            other.chained=true;
+            std::shared_ptr<message_base> const shared=
+                std::make_shared<wrapped_message<Message> >(msg);
+            std::lock_guard<std::mutex> lk(m);
+            for(queue* q:subscribers)
+            {
+                q->push_shared(shared);
+            }
         }
+    };
+
+    //一次wait()上注册的一个处理函数，从链尾经prev指回链头
+    struct handler_entry
+    {
+        handler_entry const* prev;
+        void const* type;
+        void* f;
+        void (*call)(void* f,message_base& msg);
+    };
+
+    //handler链中与处理函数类型无关的部分：等待和派发只有这一份代码，
+    //各个handler_set<Msg,Func>只负责把自己的handler_entry接到链上
+    class handler_chain
+    {
+        handler_chain(handler_chain const&)=delete;
+        handler_chain& operator=(handler_chain const&)=delete;
 
-        TemplateDispatcher(queue* q_,PreviousDispatcher* prev_,Func&& f_):
-            q(q_),prev(prev_),f(std::forward<Func>(f_)),chained(false)
+        bool dispatch(message_base& msg) const
         {
-            idx = ++t_idx;
-            //std::cout << "assign TemplateDispatcher: " << idx << std::endl;
-            prev_->chained=true;//注意这里会改变前一个dispatcher的chained状态，前一个被链接了
+            //从最后注册的处理函数往前比较类型ID，close_queue结束本次等待，
+            //由状态机检查receiver::closed()决定是否退出
+            for(handler_entry const* e=tail;e;e=e->prev)
+            {
+                if(e->type==msg.type)
+                {
+                    e->call(e->f,msg);
+                    return true;
+                }
+            }
+            return msg.type==&message_type<close_queue>::id;
         }
 
-        template<typename OtherMsg,typename OtherFunc>
-        TemplateDispatcher<TemplateDispatcher,OtherMsg,OtherFunc>
-        handle(OtherFunc&& of)
+        void wait_and_dispatch()
         {
-            return TemplateDispatcher<
-                TemplateDispatcher,OtherMsg,OtherFunc>(
-                    q,this,std::forward<OtherFunc>(of));
+            for(;;)
+            {
+                auto msg=q->wait_and_pop();
+                if(dispatch(*msg))
+                    break;//成功处理过一次消息后，会跳出循环
+            }
         }
+    protected:
+        queue* q;
+        bool chained;
+        handler_entry const* tail;
 
-        ~TemplateDispatcher() noexcept(false)  //dctor is not noexcept
+        handler_chain(queue* q_,handler_entry const* tail_):
+            q(q_),chained(false),tail(tail_)
+        {}
+        //链上的临时对象按构造的逆序析构，链尾最先析构，此时前面的handler_entry都还活着
+        void finish()
         {
             if(!chained) //当没有被连接时，即链的尾端，才会等待消息
             {
                 wait_and_dispatch();
             }
-            //std::cout << "~TemplateDispatcher: " << idx << std::endl;
         }
     };
 
-
-    class close_queue
-    {};
-
-    class dispatcher
+    //.handle<Msg>(f)返回的临时对象，保存f和指向前一个处理函数的handler_entry
+    //不可复制也不可移动，靠C++17保证的复制消除按值返回
+    template<typename Msg,typename Func>
+    class handler_set:
+        handler_chain
     {
-        queue* q;
-        bool chained;
-
-        dispatcher(dispatcher const&)=delete;
-        dispatcher& operator=(dispatcher const&)=delete;
-
-        template<
-            typename Dispatcher,
-            typename Msg,
-            typename Func>
-        friend class TemplateDispatcher;
+        Func f;
+        handler_entry entry;
 
-        void wait_and_dispatch()
+        static void call(void* f,message_base& msg)
         {
-            for(;;)
-            {
-                auto msg=q->wait_and_pop();
-                dispatch(msg);
-                //std::cout << "123" << std::endl;
-            }
+            (*static_cast<Func*>(f))(static_cast<wrapped_message<Msg>&>(msg).contents);
         }
+    public:
+        template<typename F>
+        handler_set(queue* q_,handler_entry const* prev,F&& f_):
+            handler_chain(q_,&entry),f(std::forward<F>(f_)),
+            entry{prev,&message_type<Msg>::id,&f,&call}
+        {}
 
-        bool dispatch(
-            std::shared_ptr<message_base> const& msg)
+        template<typename OtherMsg,typename OtherFunc>
+        handler_set<OtherMsg,std::decay_t<OtherFunc> >
+        handle(OtherFunc&& of)
         {
-            if(dynamic_cast<wrapped_message<close_queue>*>(msg.get()))
-            {
-                throw close_queue();
-            }
-            return false;
+            chained=true;
+            return handler_set<OtherMsg,std::decay_t<OtherFunc> >(
+                q,&entry,std::forward<OtherFunc>(of));
         }
-    public:
-        dispatcher(dispatcher&& other):
-            q(other.q),chained(other.chained)
+
+        ~handler_set()
         {
-            other.chained=true;
+            finish();
         }
+    };
 
+    //receiver::wait()返回的链头，不带处理函数时只等待close_queue
+    class dispatcher:
+        handler_chain
+    {
+    public:
         explicit dispatcher(queue* q_):
-            q(q_),chained(false)
+            handler_chain(q_,nullptr)
         {}
 
         template<typename Message,typename Func>
-        TemplateDispatcher<dispatcher,Message,Func>
+        handler_set<Message,std::decay_t<Func> >
         handle(Func&& f)
         {
-            return TemplateDispatcher<dispatcher,Message,Func>(
-                q,this,std::forward<Func>(f));
+            chained=true;
+            return handler_set<Message,std::decay_t<Func> >(
+                q,nullptr,std::forward<Func>(f));
         }
 
-        ~dispatcher() noexcept(false)
+        ~dispatcher()
         {
-            if(!chained)
-            {
-                wait_and_dispatch();
-            }
+            finish();
         }
     };
 
@@ -212,6 +388,9 @@ namespace messaging
     {
         queue q;
     public:
+        explicit receiver(wait_policy policy=wait_policy::blocking()):
+            q(policy)
+        {}
         operator sender()//一是操作符的重载，一是自定义对象类型的隐式转换。
         {
             return sender(&q);
@@ -220,5 +399,23 @@ namespace messaging
         {
             return dispatcher(&q);
         }
+        bool empty() const
+        {
+            return q.empty();
+        }
+        //关闭邮箱：deadline之前处理完已经排队的消息
+        void close(std::chrono::steady_clock::time_point deadline=
+                   std::chrono::steady_clock::time_point::max())
+        {
+            q.close(deadline);
+        }
+        bool closed() const
+        {
+            return q.closed();
+        }
+        bool expired() const
+        {
+            return q.expired();
+        }
     };
 }
\ No newline at end of file
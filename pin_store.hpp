@@ -0,0 +1,200 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//多缓冲SHA-256：一次并行计算lanes条单块(<=55字节)消息的摘要
+//状态和消息字按 [字][lane] 排布，最内层循环跨lane，编译器可以向量化成SIMD
+namespace sha256_mb
+{
+    static std::size_t const lanes=8;
+    static std::size_t const max_message=55;//单块消息的最大长度
+
+    inline std::uint32_t rotr(std::uint32_t x,unsigned n)
+    {
+        return (x>>n)|(x<<(32-n));
+    }
+
+    //messages[i]长度为lengths[i]，count<=lanes
+    inline void hash(std::uint8_t const* const* messages,
+                     std::size_t const* lengths,std::size_t count,
+                     std::array<std::uint8_t,32>* digests)
+    {
+        static std::uint32_t const k[64]={
+            0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+            0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+            0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+            0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+            0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+            0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+            0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+            0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2};
+        static std::uint32_t const init[8]={
+            0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,
+            0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19};
+
+        std::uint32_t w[64][lanes];
+        for(std::size_t l=0;l<lanes;++l)//填充：消息 || 0x80 || 0... || 比特长度
+        {
+            std::uint8_t block[64]={0};
+            if(l<count)
+            {
+                std::memcpy(block,messages[l],lengths[l]);
+                block[lengths[l]]=0x80;
+                std::uint64_t const bits=std::uint64_t(lengths[l])*8;
+                for(unsigned i=0;i<8;++i)
+                {
+                    block[63-i]=static_cast<std::uint8_t>(bits>>(8*i));
+                }
+            }
+            for(unsigned t=0;t<16;++t)
+            {
+                w[t][l]=(std::uint32_t(block[4*t])<<24)|(std::uint32_t(block[4*t+1])<<16)|
+                        (std::uint32_t(block[4*t+2])<<8)|std::uint32_t(block[4*t+3]);
+            }
+        }
+        for(unsigned t=16;t<64;++t)
+        {
+            for(std::size_t l=0;l<lanes;++l)
+            {
+                std::uint32_t const s0=rotr(w[t-15][l],7)^rotr(w[t-15][l],18)^(w[t-15][l]>>3);
+                std::uint32_t const s1=rotr(w[t-2][l],17)^rotr(w[t-2][l],19)^(w[t-2][l]>>10);
+                w[t][l]=w[t-16][l]+s0+w[t-7][l]+s1;
+            }
+        }
+
+        std::uint32_t s[8][lanes];
+        for(unsigned i=0;i<8;++i)
+        {
+            for(std::size_t l=0;l<lanes;++l)
+            {
+                s[i][l]=init[i];
+            }
+        }
+        for(unsigned t=0;t<64;++t)
+        {
+            for(std::size_t l=0;l<lanes;++l)
+            {
+                std::uint32_t const a=s[0][l],b=s[1][l],c=s[2][l],d=s[3][l];
+                std::uint32_t const e=s[4][l],f=s[5][l],g=s[6][l],h=s[7][l];
+                std::uint32_t const t1=h+(rotr(e,6)^rotr(e,11)^rotr(e,25))+((e&f)^(~e&g))+k[t]+w[t][l];
+                std::uint32_t const t2=(rotr(a,2)^rotr(a,13)^rotr(a,22))+((a&b)^(a&c)^(b&c));
+                s[7][l]=g;s[6][l]=f;s[5][l]=e;s[4][l]=d+t1;
+                s[3][l]=c;s[2][l]=b;s[1][l]=a;s[0][l]=t1+t2;
+            }
+        }
+        for(std::size_t l=0;l<count;++l)
+        {
+            for(unsigned i=0;i<8;++i)
+            {
+                std::uint32_t const v=s[i][l]+init[i];
+                digests[l][4*i]=static_cast<std::uint8_t>(v>>24);
+                digests[l][4*i+1]=static_cast<std::uint8_t>(v>>16);
+                digests[l][4*i+2]=static_cast<std::uint8_t>(v>>8);
+                digests[l][4*i+3]=static_cast<std::uint8_t>(v);
+            }
+        }
+    }
+}
+
+//按账户保存加盐的PIN摘要：digest=SHA-256(salt||pin)
+class pin_store
+{
+public:
+    typedef std::array<std::uint8_t,16> salt_type;
+    typedef std::array<std::uint8_t,32> digest_type;
+    static std::size_t const max_pin_length=sha256_mb::max_message-16;
+private:
+    struct record
+    {
+        salt_type salt;
+        digest_type digest;
+    };
+    std::unordered_map<std::string,record> records;
+    record unknown;//未知账户也走一遍哈希和比较，避免通过时间区分账户是否存在
+    std::random_device rd;
+
+    salt_type make_salt()
+    {
+        salt_type salt;
+        for(std::size_t i=0;i<salt.size();i+=4)
+        {
+            std::uint32_t const r=rd();
+            std::memcpy(&salt[i],&r,4);
+        }
+        return salt;
+    }
+    static std::size_t prepare(record const& rec,std::string const& pin,
+                               std::uint8_t* buffer)
+    {
+        std::size_t const n=pin.size()<max_pin_length?pin.size():max_pin_length;//超长的PIN只截断到缓冲区大小，由verify判定无效
+        std::memcpy(buffer,rec.salt.data(),rec.salt.size());
+        std::memcpy(buffer+rec.salt.size(),pin.data(),n);
+        return rec.salt.size()+n;
+    }
+    static bool equal(digest_type const& a,digest_type const& b)//常数时间比较
+    {
+        std::uint8_t diff=0;
+        for(std::size_t i=0;i<a.size();++i)
+        {
+            diff|=a[i]^b[i];
+        }
+        return diff==0;
+    }
+public:
+    pin_store()
+    {
+        unknown.salt=make_salt();
+        unknown.digest.fill(0);
+    }
+    //PIN超过max_pin_length字节抛出std::invalid_argument，不做截断
+    void enroll(std::string const& account,std::string const& pin)
+    {
+        if(pin.size()>max_pin_length)
+        {
+            throw std::invalid_argument("PIN longer than pin_store::max_pin_length");
+        }
+        record rec;
+        rec.salt=make_salt();
+        std::uint8_t buffer[sha256_mb::max_message];
+        std::uint8_t const* message=buffer;
+        std::size_t const length=prepare(rec,pin,buffer);
+        sha256_mb::hash(&message,&length,1,&rec.digest);
+        records[account]=rec;
+    }
+    //批量校验：accounts[i]/pins[i]的结果写入results[i]，超长的PIN一律不通过
+    void verify(std::string const* const* accounts,
+                std::string const* const* pins,
+                std::size_t count,bool* results) const
+    {
+        for(std::size_t base=0;base<count;base+=sha256_mb::lanes)
+        {
+            std::size_t const n=count-base<sha256_mb::lanes?count-base:sha256_mb::lanes;
+            std::uint8_t buffers[sha256_mb::lanes][sha256_mb::max_message];
+            std::uint8_t const* messages[sha256_mb::lanes];
+            std::size_t lengths[sha256_mb::lanes];
+            record const* recs[sha256_mb::lanes];
+            bool valid[sha256_mb::lanes];
+            for(std::size_t l=0;l<n;++l)
+            {
+                auto it=records.find(*accounts[base+l]);
+                bool const known=it!=records.end();
+                valid[l]=known && pins[base+l]->size()<=max_pin_length;
+                recs[l]=known?&it->second:&unknown;
+                lengths[l]=prepare(*recs[l],*pins[base+l],buffers[l]);
+                messages[l]=buffers[l];
+            }
+            digest_type digests[sha256_mb::lanes];
+            sha256_mb::hash(messages,lengths,n,digests);
+            for(std::size_t l=0;l<n;++l)
+            {
+                results[base+l]=equal(digests[l],recs[l]->digest)&valid[l];
+            }
+        }
+    }
+};
@@ -0,0 +1,228 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+namespace messaging
+{
+    //线程放置：把状态机的run()循环绑定到指定的CPU上
+    //cpu<0 表示不绑定，由调度器决定；返回0或pthread_setaffinity_np的错误码
+    inline int pin_current_thread(int cpu)
+    {
+        if(cpu<0)
+        {
+            return 0;
+        }
+        if(cpu>=CPU_SETSIZE)
+        {
+            return EINVAL;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu,&set);
+        return pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+    }
+
+    //当前进程允许使用的CPU(受taskset/cpuset限制)
+    inline std::vector<int> allowed_cpus()
+    {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if(sched_getaffinity(0,sizeof(set),&set)==0)
+        {
+            for(int cpu=0;cpu<CPU_SETSIZE;++cpu)
+            {
+                if(CPU_ISSET(cpu,&set))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+        return cpus;
+    }
+
+    inline int read_topology(int cpu,char const* field)
+    {
+        std::ifstream in("/sys/devices/system/cpu/cpu"+std::to_string(cpu)+
+                         "/topology/"+field);
+        int value=-1;
+        in>>value;
+        return value;
+    }
+
+    //按(物理封装, 物理核, CPU号)排序允许使用的CPU：
+    //同一物理核上的超线程相邻(共享L1/L2)，其次是同一封装内的核(共享LLC)
+    inline std::vector<int> nearby_cpus()
+    {
+        std::vector<std::tuple<int,int,int> > order;
+        for(int cpu:allowed_cpus())
+        {
+            order.emplace_back(read_topology(cpu,"physical_package_id"),
+                               read_topology(cpu,"core_id"),cpu);
+        }
+        std::sort(order.begin(),order.end());
+        std::vector<int> cpus;
+        for(auto const& t:order)
+        {
+            cpus.push_back(std::get<2>(t));
+        }
+        return cpus;
+    }
+
+    //解析 "0,2,4" 或 "auto" 形式的CPU列表，格式错误抛出std::invalid_argument
+    //"auto" 按nearby_cpus()的顺序依次分配，使互相通信的状态机落在相邻的核上
+    inline std::vector<int> parse_cpu_list(char const* spec,unsigned count)
+    {
+        std::vector<int> cpus(count,-1);
+        if(!spec || !*spec)
+        {
+            return cpus;
+        }
+        if(std::string(spec)=="auto")
+        {
+            std::vector<int> const nearby=nearby_cpus();
+            for(unsigned i=0;i<count && !nearby.empty();++i)
+            {
+                cpus[i]=nearby[i%nearby.size()];
+            }
+            return cpus;
+        }
+        char const* p=spec;
+        for(unsigned i=0;i<count && *p;++i)
+        {
+            char* end=nullptr;
+            errno=0;
+            long cpu=std::strtol(p,&end,10);
+            if(end==p || errno || cpu<0 || cpu>=CPU_SETSIZE || (*end && *end!=','))
+            {
+                throw std::invalid_argument(std::string("bad CPU list \"")+spec+"\"");
+            }
+            cpus[i]=static_cast<int>(cpu);
+            p=(*end==',')?end+1:end;
+        }
+        if(*p)
+        {
+            throw std::invalid_argument(std::string("too many CPUs in \"")+spec+"\"");
+        }
+        return cpus;
+    }
+
+    //启动状态机线程：先在新线程里完成绑核再进入run()
+    //绑核失败(比如CPU不在允许的集合里)时报告到std::cerr，线程不绑核继续运行
+    template<typename Machine>
+    std::thread launch(Machine& machine,char const* name,int cpu=-1)
+    {
+        std::promise<int> pinned;
+        std::future<int> result=pinned.get_future();
+        //promise随线程一起移走：set_value返回之前调用方可能已经离开这个函数
+        std::thread t([&machine,cpu,pinned=std::move(pinned)]() mutable
+        {
+            pinned.set_value(pin_current_thread(cpu));
+            machine.run();
+        });
+        pthread_setname_np(t.native_handle(),name);
+        if(int const err=result.get())
+        {
+            std::cerr<<"cannot pin "<<name<<" to CPU "<<cpu<<": "
+                     <<std::strerror(err)<<std::endl;
+        }
+        return t;
+    }
+
+    //在绑核之后的线程里构造状态机，再在同一个线程里调用setup(machine)和run()
+    //构造函数里分配并写入的内存(邮箱的首个deque块、账户表、PIN表、限流表)由这个线程首次写入，
+    //按Linux默认的first-touch策略落在该CPU所在的NUMA节点上。
+    //之后push()里分配的消息和deque块仍然来自生产者线程
+    template<typename Machine>
+    class placed_machine
+    {
+        std::unique_ptr<Machine> machine;
+        std::thread thread;
+
+        placed_machine(placed_machine const&)=delete;
+        placed_machine& operator=(placed_machine const&)=delete;
+    public:
+        //构造函数或setup抛出的异常在调用方重新抛出
+        template<typename Setup,typename... Args>
+        placed_machine(char const* name,int cpu,Setup setup,Args... args)
+        {
+            std::promise<std::pair<Machine*,int> > ready;
+            std::future<std::pair<Machine*,int> > result=ready.get_future();
+            thread=std::thread([ready=std::move(ready),cpu,setup,args...]() mutable
+            {
+                int const err=pin_current_thread(cpu);
+                Machine* m=nullptr;
+                try
+                {
+                    std::unique_ptr<Machine> owned(new Machine(args...));
+                    setup(*owned);
+                    m=owned.release();
+                }
+                catch(...)
+                {
+                    ready.set_exception(std::current_exception());
+                    return;
+                }
+                ready.set_value(std::make_pair(m,err));
+                m->run();
+            });
+            pthread_setname_np(thread.native_handle(),name);
+            std::pair<Machine*,int> placed;
+            try
+            {
+                placed=result.get();
+            }
+            catch(...)
+            {
+                thread.join();
+                throw;
+            }
+            machine.reset(placed.first);
+            if(placed.second)
+            {
+                std::cerr<<"cannot pin "<<name<<" to CPU "<<cpu<<": "
+                         <<std::strerror(placed.second)<<std::endl;
+            }
+        }
+        //析构前必须已经让run()返回(比如调用了done())
+        ~placed_machine()
+        {
+            if(thread.joinable())
+            {
+                thread.join();
+            }
+        }
+        Machine& operator*() const
+        {
+            return *machine;
+        }
+        Machine* operator->() const
+        {
+            return machine.get();
+        }
+        void join()
+        {
+            thread.join();
+        }
+    };
+
+    //placed_machine不需要额外初始化时的setup
+    struct no_setup
+    {
+        template<typename Machine>
+        void operator()(Machine&) const
+        {}
+    };
+}
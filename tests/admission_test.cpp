@@ -0,0 +1,133 @@
+#include "admission.hpp"
+#include "check.hpp"
+#include <cstdio>
+#include <string>
+#include <thread>
+
+static char atm_ids[8192];//用不同的地址模拟不同的ATM，不让ATM的令牌桶挡住请求
+static std::size_t const capacity=4096;
+
+static void fill(admission_control& admission,unsigned count)
+{
+    for(unsigned i=0;i<count;++i)
+    {
+        admission.admit("filler"+std::to_string(i),&atm_ids[i%sizeof(atm_ids)]);
+    }
+}
+
+//连续输错PIN，返回被放行的次数
+static unsigned wrong_pins(admission_control& admission,std::string const& account,unsigned attempts)
+{
+    unsigned admitted=0;
+    for(unsigned i=0;i<attempts;++i)
+    {
+        if(admission.admit(account,&atm_ids[i%sizeof(atm_ids)],true))
+        {
+            ++admitted;
+            admission.record_pin_result(account,false);
+        }
+    }
+    return admitted;
+}
+
+//表被占满且没有可回收的槽时，PIN尝试必须被拒绝而不是绕过锁定
+static void full_table_keeps_lockout()
+{
+    admission_control admission(admission_limits{5,10,3,std::chrono::minutes(5)},capacity);
+    fill(admission,6000);
+    CHECK(wrong_pins(admission,"target",1000)<=3);
+}
+
+//桶已补满的空闲槽可以回收，新账户照常计数并锁定
+static void idle_slots_are_reclaimed()
+{
+    admission_control admission(admission_limits{1000,10,3,std::chrono::minutes(5)},capacity);
+    fill(admission,6000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(wrong_pins(admission,"target",1000)==3);
+    CHECK(admission.admit("fresh",&atm_ids[0]));
+}
+
+//有未过期错误记录的槽不会被回收
+static void failures_survive_pressure()
+{
+    admission_control admission(admission_limits{1000,10,3,std::chrono::minutes(5)},capacity);
+    CHECK(wrong_pins(admission,"target",1)==1);
+    fill(admission,6000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    fill(admission,6000);
+    CHECK(wrong_pins(admission,"target",1000)==2);
+}
+
+//令牌桶本身：突发之后被限流，补充之后恢复
+static void bucket_throttles()
+{
+    admission_control admission(admission_limits{100,10,3,std::chrono::minutes(5)},capacity);
+    unsigned admitted=0;
+    for(unsigned i=0;i<100;++i)
+    {
+        admitted+=admission.admit("acc",&atm_ids[i]);
+    }
+    CHECK(admitted>=10 && admitted<=11);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(admission.admit("acc",&atm_ids[0]));
+}
+
+//时间戳不能在2^44微秒(约203天)之后溢出，也不能让限流失效
+static void bucket_survives_long_uptime()
+{
+    std::uint64_t const starts[]={1000,std::uint64_t(1)<<44,std::uint64_t(1)<<50};
+    for(std::uint64_t start:starts)
+    {
+        rate_table table(capacity,5,10,5*60*1000000ull);
+        unsigned admitted=0;
+        for(unsigned i=0;i<1000;++i)
+        {
+            admitted+=table.acquire(42,start+i,true);
+        }
+        CHECK(admitted==10);
+    }
+}
+
+//只差最低位的键是两个不同的账户，不能共用桶
+static void adjacent_keys_are_distinct()
+{
+    rate_table table(capacity,5,10,5*60*1000000ull);
+    unsigned admitted=0;
+    for(unsigned i=0;i<20;++i)
+    {
+        admitted+=table.acquire(2,1000,true);
+        admitted+=table.acquire(3,1000,true);
+        admitted+=table.acquire(0,1000,true);
+    }
+    CHECK(admitted==30);
+}
+
+//结果还没出来的PIN校验也算数：同时在途的最多max_pin_failures个
+static void pending_pins_count_against_lockout()
+{
+    admission_control admission(admission_limits{5,10,3,std::chrono::minutes(5)},capacity);
+    unsigned admitted=0;
+    for(unsigned i=0;i<40;++i)
+    {
+        admitted+=admission.admit("target",&atm_ids[i],true);
+    }
+    CHECK(admitted==3);
+    admission.record_pin_result("target",true);//一个校验通过，让出一个位置
+    CHECK(admission.admit("target",&atm_ids[100],true));
+    CHECK(!admission.admit("target",&atm_ids[101],true));
+    //其他请求不受在途PIN校验的影响
+    CHECK(admission.admit("target",&atm_ids[102]));
+}
+
+int main()
+{
+    full_table_keeps_lockout();
+    idle_slots_are_reclaimed();
+    failures_survive_pressure();
+    bucket_throttles();
+    bucket_survives_long_uptime();
+    adjacent_keys_are_distinct();
+    pending_pins_count_against_lockout();
+    return report("admission_test");
+}
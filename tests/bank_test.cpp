@@ -0,0 +1,140 @@
+#include "action.hpp"
+#include "check.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock clock_type;
+
+//verify_pin后面排着大量别的请求时，PIN校验不能等到邮箱清空才回复
+static void pin_reply_behind_backlog()
+{
+    bank_machine bank;
+    messaging::sender to_bank=bank.get_sender();
+    messaging::receiver atm_queue;
+    messaging::receiver flood_replies;
+    std::size_t const backlog=300000;
+    to_bank.send(verify_pin("acc1234","1937",atm_queue));
+    for(std::size_t i=0;i<backlog;++i)
+    {
+        to_bank.send(withdraw("evil",1,flood_replies));
+    }
+
+    clock_type::time_point const start=clock_type::now();
+    std::thread bank_thread(&bank_machine::run,&bank);
+    bool verified=false;
+    atm_queue.wait()
+        .handle<pin_verified>(
+            [&](pin_verified const& msg)
+            {
+                verified=true;
+            }
+            );
+    clock_type::time_point const replied=clock_type::now();
+    bank.done();
+    bank_thread.join();
+    clock_type::time_point const drained=clock_type::now();
+
+    CHECK(verified);
+    //回复应当在处理积压的前一小部分时就到达
+    CHECK((replied-start)*10<(drained-start));
+    std::printf("pin reply after %.2f ms, backlog drained after %.2f ms\n",
+                std::chrono::duration<double,std::milli>(replied-start).count(),
+                std::chrono::duration<double,std::milli>(drained-start).count());
+}
+
+static unsigned query_balance(messaging::sender& to_bank,messaging::receiver& replies)
+{
+    unsigned amount=0;
+    to_bank.send(get_balance("acc1234",replies));
+    replies.wait()
+        .handle<balance>(
+            [&](balance const& msg)
+            {
+                amount=msg.amount;
+            }
+            );
+    return amount;
+}
+
+static void withdraw_ok_reply(messaging::sender& to_bank,messaging::receiver& replies,unsigned amount)
+{
+    to_bank.send(withdraw("acc1234",amount,replies));
+    replies.wait()
+        .handle<withdraw_ok>(
+            [&](withdraw_ok const& msg)
+            {
+            }
+            );
+}
+
+//取消的取款退回扣款，已经出钞的和被拒绝的取款不退
+static void cancel_refunds_debit()
+{
+    bank_machine bank;
+    messaging::sender to_bank=bank.get_sender();
+    messaging::receiver replies;
+    std::thread bank_thread(&bank_machine::run,&bank);
+
+    withdraw_ok_reply(to_bank,replies,50);
+    CHECK(query_balance(to_bank,replies)==149);
+    to_bank.send(cancel_withdrawal("acc1234",50));
+    CHECK(query_balance(to_bank,replies)==199);
+
+    withdraw_ok_reply(to_bank,replies,20);
+    to_bank.send(withdrawal_processed("acc1234",20));
+    to_bank.send(cancel_withdrawal("acc1234",20));
+    CHECK(query_balance(to_bank,replies)==179);
+
+    to_bank.send(cancel_withdrawal("acc1234",1000));//没有对应的扣款
+    CHECK(query_balance(to_bank,replies)==179);
+
+    bank.done();
+    bank_thread.join();
+}
+
+//攒批期间排队的错误PIN不能绕过锁定：不同ATM同时发来40个，只校验max_pin_failures个
+static void batched_wrong_pins_respect_lockout()
+{
+    bank_machine bank;
+    messaging::sender to_bank=bank.get_sender();
+    std::vector<std::unique_ptr<messaging::receiver> > atms;
+    for(unsigned i=0;i<40;++i)
+    {
+        atms.emplace_back(new messaging::receiver);
+        to_bank.send(verify_pin("acc1234","0000",*atms.back()));
+    }
+    std::thread bank_thread(&bank_machine::run,&bank);
+    unsigned incorrect=0,throttled=0;
+    for(auto& a:atms)
+    {
+        a->wait()
+            .handle<pin_incorrect>(
+                [&](pin_incorrect const& msg)
+                {
+                    ++incorrect;
+                }
+                )
+            .handle<request_throttled>(
+                [&](request_throttled const& msg)
+                {
+                    ++throttled;
+                }
+                );
+    }
+    bank.done();
+    bank_thread.join();
+    CHECK(incorrect==bank_machine::default_limits().max_pin_failures);
+    CHECK(incorrect+throttled==40);
+}
+
+int main()
+{
+    pin_reply_behind_backlog();
+    cancel_refunds_debit();
+    batched_wrong_pins_respect_lockout();
+    return report("bank_test");
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdio>
+
+//测试共用的检查宏：失败时打印位置并计数，main最后用report()给出退出码
+static int failures=0;
+#define CHECK(cond) \
+    do{ if(!(cond)){ std::printf("%s:%d: CHECK(%s) failed\n",__FILE__,__LINE__,#cond); ++failures; } }while(0)
+
+inline int report(char const* name)
+{
+    if(failures)
+    {
+        std::printf("%d check(s) failed\n",failures);
+        return 1;
+    }
+    std::printf("%s passed\n",name);
+    return 0;
+}
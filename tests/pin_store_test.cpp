@@ -0,0 +1,143 @@
+#include "pin_store.hpp"
+#include "check.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static std::string hex(std::array<std::uint8_t,32> const& d)
+{
+    static char const digits[]="0123456789abcdef";
+    std::string s;
+    for(std::uint8_t b:d)
+    {
+        s+=digits[b>>4];
+        s+=digits[b&15];
+    }
+    return s;
+}
+
+//已知答案测试：期望值来自sha256sum
+static void sha256_known_answers()
+{
+    struct vector_type
+    {
+        std::string message;
+        char const* digest;
+    };
+    std::vector<vector_type> const vectors={
+        {"","e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc","ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"The quick brown fox jumps over the lazy dog",
+         "d7a8fbb307d7809469ca9abcb0082e4f8d5651e46d3cdb762d02d0bf37c9e592"},
+        {std::string(55,'a'),"9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318"},
+    };
+    for(auto const& v:vectors)//单条
+    {
+        std::uint8_t const* m=reinterpret_cast<std::uint8_t const*>(v.message.data());
+        std::size_t const n=v.message.size();
+        std::array<std::uint8_t,32> d;
+        sha256_mb::hash(&m,&n,1,&d);
+        CHECK(hex(d)==v.digest);
+    }
+
+    //多条一起算，每个lane长度不同，结果必须和单独计算一致
+    char const* const lane_digests[sha256_mb::lanes]={
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+        "761ca8fd7dd51248e00a7dc1c746bbde94e51cb06aa67194843c495a863e0106",
+        "c3a3674842d925c4a400b5b98383f894363e98bf1d328bba0dcf44852ae9a0e2",
+        "d5a8e1ebe225ff76f439f646e7bcb7a7c1e7b9dd2e3e548c3012bb69e3190986",
+        "f7574141cb2eb085242e82b0ed8527dec72391af88bf45d6eb4f511e9cd56e9c",
+        "1c069157b6d7f13964c1efccc88579fe993a6daa41e973c1c2d16511aceffecd",
+        "480691868a39b2e613f6bda1c280c79f68d7466b0e2190ff7e9ea3dbbc665bd9",
+        "2c2c059b0221fb27c9b40abf5f36fdaa4757a4f11233d66e93ccafba447a2d50",
+    };
+    std::uint8_t buffers[sha256_mb::lanes][sha256_mb::max_message];
+    std::uint8_t const* messages[sha256_mb::lanes];
+    std::size_t lengths[sha256_mb::lanes];
+    for(std::size_t l=0;l<sha256_mb::lanes;++l)//lane l：字节 5l, 5l+1, ... 共5l个
+    {
+        for(std::size_t i=0;i<5*l;++i)
+        {
+            buffers[l][i]=static_cast<std::uint8_t>(5*l+i);
+        }
+        messages[l]=buffers[l];
+        lengths[l]=5*l;
+    }
+    std::array<std::uint8_t,32> digests[sha256_mb::lanes];
+    sha256_mb::hash(messages,lengths,sha256_mb::lanes,digests);
+    for(std::size_t l=0;l<sha256_mb::lanes;++l)
+    {
+        CHECK(hex(digests[l])==lane_digests[l]);
+    }
+}
+
+static bool verify_one(pin_store const& store,std::string const& account,std::string const& pin)
+{
+    std::string const* a=&account;
+    std::string const* p=&pin;
+    bool ok=false;
+    store.verify(&a,&p,1,&ok);
+    return ok;
+}
+
+static void pin_store_verify()
+{
+    pin_store store;
+    store.enroll("acc1234","1937");
+    CHECK(verify_one(store,"acc1234","1937"));
+    CHECK(!verify_one(store,"acc1234","1938"));
+    CHECK(!verify_one(store,"acc1234",""));
+    CHECK(!verify_one(store,"nobody","1937"));
+
+    //批量里混合对错，跨越多个lane分组
+    std::vector<std::string> accounts,pins;
+    for(int i=0;i<20;++i)
+    {
+        accounts.push_back("acc"+std::to_string(i));
+        pins.push_back(std::to_string(1000+i));
+        store.enroll(accounts.back(),pins.back());
+    }
+    std::vector<std::string const*> a,p;
+    std::vector<std::string> wrong(20);
+    for(int i=0;i<20;++i)
+    {
+        wrong[i]=(i%3==0)?"0000":pins[i];
+        a.push_back(&accounts[i]);
+        p.push_back(&wrong[i]);
+    }
+    bool results[20];
+    store.verify(a.data(),p.data(),20,results);
+    for(int i=0;i<20;++i)
+    {
+        CHECK(results[i]==(i%3!=0));
+    }
+}
+
+static void pin_store_rejects_long_pins()
+{
+    pin_store store;
+    std::string const longest(pin_store::max_pin_length,'7');
+    store.enroll("max",longest);
+    CHECK(verify_one(store,"max",longest));
+    //前max_pin_length字节相同的更长PIN不能通过
+    CHECK(!verify_one(store,"max",longest+"0"));
+
+    bool threw=false;
+    try
+    {
+        store.enroll("too_long",longest+"0");
+    }
+    catch(std::invalid_argument const&)
+    {
+        threw=true;
+    }
+    CHECK(threw);
+}
+
+int main()
+{
+    sha256_known_answers();
+    pin_store_verify();
+    pin_store_rejects_long_pins();
+    return report("pin_store_test");
+}
@@ -0,0 +1,192 @@
+#include "action.hpp"
+#include "check.hpp"
+#include <chrono>
+#include <thread>
+
+typedef std::chrono::steady_clock clock_type;
+
+struct tick
+{};
+
+//取一条消息，返回是否是tick(否则是close_queue)
+static bool receive_tick(messaging::receiver& r)
+{
+    bool got=false;
+    r.wait()
+        .handle<tick>(
+            [&](tick const& msg)
+            {
+                got=true;
+            }
+            );
+    return got;
+}
+
+//deadline之前关闭：排在标记前面的消息照常处理，然后closed()
+static void close_drains_before_deadline()
+{
+    messaging::receiver r;
+    messaging::sender s=r;
+    for(int i=0;i<100;++i)
+    {
+        s.send(tick());
+    }
+    r.close();
+    int handled=0;
+    while(!r.closed())
+    {
+        handled+=receive_tick(r);
+    }
+    CHECK(handled==100);
+}
+
+//deadline已过：标记前面的消息直接丢弃
+static void close_drops_backlog_after_deadline()
+{
+    messaging::receiver r;
+    messaging::sender s=r;
+    for(int i=0;i<100;++i)
+    {
+        s.send(tick());
+    }
+    r.close(clock_type::now()-std::chrono::milliseconds(1));
+    CHECK(!receive_tick(r));
+    CHECK(r.closed());
+    CHECK(r.expired());
+}
+
+//关闭之后到达的消息(在途的回复)照常交付；没有消息时等到deadline再交出一次close_queue
+static void close_queue_reissued_at_deadline()
+{
+    messaging::receiver r;
+    messaging::sender s=r;
+    clock_type::time_point const deadline=clock_type::now()+std::chrono::milliseconds(50);
+    r.close(deadline);
+    CHECK(!receive_tick(r));
+    CHECK(r.closed() && !r.expired());
+    s.send(tick());
+    CHECK(receive_tick(r));
+    CHECK(!receive_tick(r));
+    clock_type::time_point const returned=clock_type::now();
+    CHECK(returned>=deadline);
+    CHECK(returned<deadline+std::chrono::seconds(1));
+    CHECK(r.expired());
+    CHECK(!receive_tick(r));//到期后不再阻塞
+}
+
+//模拟bank和终端的两个邮箱，驱动atm走到取款请求已发出、还没有回复的状态
+struct atm_rig
+{
+    messaging::receiver bank;
+    messaging::receiver hardware;
+    atm machine;
+    std::thread thread;
+    messaging::sender atm_queue;
+    unsigned cancels,processed,issued,ejects;
+
+    atm_rig():
+        machine(bank,hardware),thread(&atm::run,&machine),
+        cancels(0),processed(0),issued(0),ejects(0)
+    {
+        messaging::sender to_atm=machine.get_sender();
+        to_atm.send(card_inserted("acc1234"));
+        for(char d:std::string("1937"))
+        {
+            to_atm.send(digit_pressed(d));
+        }
+        bank.wait()
+            .handle<verify_pin>(
+                [&](verify_pin const& msg)
+                {
+                    atm_queue=msg.atm_queue;
+                }
+                );
+        atm_queue.send(pin_verified());
+        to_atm.send(withdraw_pressed(50));
+        bank.wait()
+            .handle<withdraw>(
+                [&](withdraw const& msg)
+                {
+                }
+                );
+    }
+    //atm退出之后，统计它发给bank和终端的消息
+    void finish()
+    {
+        thread.join();
+        bank.close();
+        while(!bank.closed())
+        {
+            bank.wait()
+                .handle<cancel_withdrawal>(
+                    [&](cancel_withdrawal const& msg)
+                    {
+                        cancels+=msg.amount==50;
+                    }
+                    )
+                .handle<withdrawal_processed>(
+                    [&](withdrawal_processed const& msg)
+                    {
+                        ++processed;
+                    }
+                    );
+        }
+        hardware.close();
+        while(!hardware.closed())
+        {
+            hardware.wait()
+                .handle<issue_money>(
+                    [&](issue_money const& msg)
+                    {
+                        ++issued;
+                    }
+                    )
+                .handle<eject_card>(
+                    [&](eject_card const& msg)
+                    {
+                        ++ejects;
+                    }
+                    );
+        }
+    }
+};
+
+//bank到deadline都没有回复：atm取消取款并退卡后退出
+static void atm_cancels_pending_withdrawal_on_expiry()
+{
+    atm_rig rig;
+    clock_type::time_point const deadline=clock_type::now()+std::chrono::milliseconds(50);
+    rig.machine.done(deadline);
+    rig.finish();
+    CHECK(clock_type::now()>=deadline);
+    CHECK(rig.cancels==1);
+    CHECK(rig.processed==0);
+    CHECK(rig.issued==0);
+    CHECK(rig.ejects==1);
+}
+
+//关闭后bank的回复在deadline之前到达：atm完成取款，不取消，不必等到deadline
+static void atm_waits_for_inflight_reply()
+{
+    atm_rig rig;
+    clock_type::time_point const deadline=clock_type::now()+std::chrono::seconds(10);
+    rig.machine.done(deadline);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    rig.atm_queue.send(withdraw_ok());
+    rig.finish();
+    CHECK(clock_type::now()<deadline);
+    CHECK(rig.cancels==0);
+    CHECK(rig.processed==1);
+    CHECK(rig.issued==1);
+    CHECK(rig.ejects==1);
+}
+
+int main()
+{
+    close_drains_before_deadline();
+    close_drops_backlog_after_deadline();
+    close_queue_reissued_at_deadline();
+    atm_cancels_pending_withdrawal_on_expiry();
+    atm_waits_for_inflight_reply();
+    return report("shutdown_test");
+}
@@ -0,0 +1,97 @@
+#include "message.hpp"
+#include "check.hpp"
+#include <thread>
+
+struct notice
+{
+    int value;
+};
+
+//取出一条notice，返回它在内存里的地址
+static notice const* receive(messaging::receiver& r,int& value)
+{
+    notice const* seen=nullptr;
+    r.wait()
+        .handle<notice>(
+            [&](notice const& msg)
+            {
+                seen=&msg;
+                value=msg.value;
+            }
+            );
+    return seen;
+}
+
+//所有订阅者收到的是同一份消息
+static void subscribers_share_one_allocation()
+{
+    messaging::receiver a,b,c;
+    messaging::topic topic;
+    topic.subscribe(a);
+    topic.subscribe(b);
+    topic.subscribe(c);
+    topic.publish(notice{7});
+    int va=0,vb=0,vc=0;
+    notice const* pa=receive(a,va);
+    notice const* pb=receive(b,vb);
+    notice const* pc=receive(c,vc);
+    CHECK(va==7 && vb==7 && vc==7);
+    CHECK(pa==pb && pb==pc);
+}
+
+static void unsubscribe_stops_delivery()
+{
+    messaging::receiver a,b;
+    messaging::topic topic;
+    topic.subscribe(a);
+    topic.subscribe(b);
+    topic.unsubscribe(a);
+    topic.publish(notice{1});
+    CHECK(a.empty());
+    CHECK(!b.empty());
+    topic.unsubscribe(b);
+    int v=0;
+    receive(b,v);
+    topic.publish(notice{2});
+    CHECK(a.empty() && b.empty());
+}
+
+//一个订阅者从不取消息，另一个订阅者照常逐条收到，发布方也不会被拖住
+static void stalled_subscriber_does_not_delay_others()
+{
+    int const messages=10000;
+    messaging::receiver stalled,live;
+    messaging::topic topic;
+    topic.subscribe(stalled);
+    topic.subscribe(live);
+    int received=0;
+    bool in_order=true;
+    std::thread consumer([&]
+    {
+        for(int i=0;i<messages;++i)
+        {
+            int v=-1;
+            receive(live,v);
+            in_order=in_order && v==i;
+            ++received;
+        }
+    });
+    for(int i=0;i<messages;++i)
+    {
+        topic.publish(notice{i});
+    }
+    consumer.join();
+    CHECK(received==messages);
+    CHECK(in_order);
+    CHECK(!stalled.empty());
+    topic.unsubscribe(stalled);
+    topic.unsubscribe(live);
+}
+
+int main()
+{
+    subscribers_share_one_allocation();
+    unsubscribe_stops_delivery();
+    stalled_subscriber_does_not_delay_others();
+    return report("topic_test");
+}